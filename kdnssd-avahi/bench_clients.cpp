@@ -0,0 +1,90 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+Creates and resolves growing numbers of RemoteServices and prints how many client
+connections were opened and how long it took. All services have to share connections
+opened at startup and time per service must not grow much with number of services, exits
+with 1 otherwise. Needs running avahi-daemon, without it nothing is measured.
+*/
+
+#include <stdio.h>
+#include <qapplication.h>
+#include <qdatetime.h>
+#include <qvaluelist.h>
+#include <kinstance.h>
+#include "remoteservice.h"
+#include "responder.h"
+#include "benchclient.h"
+
+// largest run, and allowed growth of time per service against run 10 times smaller
+#define MAX_COUNT 10000
+#define GROWTH 3
+// ms to wait for daemon at startup
+#define STARTUP 5000
+
+using namespace DNSSD;
+
+// returns true if no client connection was opened, perService gets time in us
+static bool run(uint count, double& perService)
+{
+	uint clients = clientsCreated();
+	QValueList<RemoteService::Ptr> services;
+	QTime time;
+	time.start();
+	for (uint i=0; i<count; i++) {
+		RemoteService::Ptr svr = new RemoteService(QString("bench %1").arg(i), "_bench._tcp",
+			"local.");
+		svr->resolveAsync();
+		services.append(svr);
+	}
+	int elapsed = time.elapsed();
+	perService = elapsed*1000.0/count;
+	printf("%6u services: %u new client connections, %6d ms, %8.2f us per service\n", count,
+		clientsCreated()-clients, elapsed, perService);
+	return clientsCreated()==clients;
+}
+
+int main(int argc, char** argv)
+{
+	KInstance instance("bench_clients");
+	QApplication app(argc, argv, false);
+	// connect configured clients first, they are not counted
+	QTime time;
+	time.start();
+	while (Responder::self().state()!=AVAHI_CLIENT_S_RUNNING && !Responder::self().failed() &&
+		time.elapsed()<STARTUP) Responder::self().process(100);
+	if (Responder::self().state()!=AVAHI_CLIENT_S_RUNNING) {
+		// reconnection attempts would be counted
+		printf("SKIP: avahi-daemon is not running\n");
+		return 0;
+	}
+	printf("%u client connections at startup\n", clientsCreated());
+	bool ok = true;
+	double previous = 0;
+	for (uint count=10; count<=MAX_COUNT; count*=10) {
+		double perService;
+		ok &= run(count, perService);
+		// small runs are dominated by noise
+		if (count==MAX_COUNT) ok &= perService<=GROWTH*previous+10;
+		previous = perService;
+		qApp->processEvents();
+	}
+	printf("%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
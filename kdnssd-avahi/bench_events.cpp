@@ -0,0 +1,140 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+Feeds browse churn into queue of SharedBrowser the way avahi callbacks do and counts heap
+allocations in steady state on the whole path to Query::recordAdded() and recordRemoved().
+Names repeat, so after warm-up they all come from string pools and instance records of
+browser and query are reused. Only remaining allocations should be Qt's own bookkeeping
+of posted wake-up events and timers, a few per batch. Exits with 1 if there are more.
+serviceAdded() is not connected, it creates RemoteService for every instance by design.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <qapplication.h>
+#include <kinstance.h>
+#include "query.h"
+#include "sharedbrowser.h"
+
+#define NAMES 1000
+#define BATCH 100
+#define WARMUP 20
+#define ROUNDS 200
+// allowed allocations per batch
+#define PER_BATCH 4
+
+static bool counting = false;
+static unsigned long allocations = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc)
+{
+	if (counting) allocations++;
+	void* p = malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) throw()
+{
+	free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	free(p);
+}
+
+using namespace DNSSD;
+
+class Counter : public QObject
+{
+	Q_OBJECT
+public:
+	Counter() : m_added(0), m_removed(0) {}
+	unsigned long m_added;
+	unsigned long m_removed;
+public slots:
+	void added(const DNSSD::ServiceRecord&) { m_added++; }
+	void removed(const DNSSD::ServiceRecord&) { m_removed++; }
+};
+
+static char names[NAMES][32];
+
+// adds batch of services and then removes them, each in its own batch
+static void round(SharedBrowser* browser, uint r)
+{
+	uint first = (r*BATCH)%NAMES;
+	for (uint i=first; i<first+BATCH; i++)
+		browser->queue()->add(AddRemoveEvent::Add, names[i], "_bench._tcp", "local", 1, 0);
+	QApplication::sendPostedEvents(browser, 0);
+	for (uint i=first; i<first+BATCH; i++)
+		browser->queue()->add(AddRemoveEvent::Remove, names[i], "_bench._tcp", "local", 1, 0);
+	QApplication::sendPostedEvents(browser, 0);
+}
+
+int main(int argc, char** argv)
+{
+	KInstance instance("bench_events");
+	QApplication app(argc, argv, false);
+	for (uint i=0; i<NAMES; i++) snprintf(names[i], sizeof(names[i]), "bench %u", i);
+
+	Query query("_bench._tcp", "local.");
+	Counter counter;
+	QObject::connect(&query, SIGNAL(recordAdded(const DNSSD::ServiceRecord&)), &counter,
+		SLOT(added(const DNSSD::ServiceRecord&)));
+	QObject::connect(&query, SIGNAL(recordRemoved(const DNSSD::ServiceRecord&)), &counter,
+		SLOT(removed(const DNSSD::ServiceRecord&)));
+	query.startQuery();
+	if (!query.isRunning()) {
+		printf("SKIP: browser cannot be created\n");
+		return 0;
+	}
+	// subscribes query to browser
+	QApplication::sendPostedEvents(&query, 0);
+	// the same browser query got
+	SharedBrowser* browser = SharedBrowser::acquire("_bench._tcp", "local.", AVAHI_IF_UNSPEC,
+		AVAHI_PROTO_UNSPEC);
+
+	uint r = 0;
+	for ( ; r<WARMUP; r++) round(browser, r);
+	unsigned long added = counter.m_added;
+	unsigned long removed = counter.m_removed;
+	counting = true;
+	for ( ; r<WARMUP+ROUNDS; r++) round(browser, r);
+	counting = false;
+	added = counter.m_added-added;
+	removed = counter.m_removed-removed;
+	browser->release();
+
+	unsigned long delivered = added+removed;
+	printf("%lu instances added and %lu removed in %u batches, %lu allocations, %.3f per event\n",
+		added, removed, 2*ROUNDS, allocations, delivered ? (double)allocations/delivered : 0.0);
+	bool ok = added==(unsigned long)ROUNDS*BATCH && removed==added &&
+		allocations<=(unsigned long)PER_BATCH*2*ROUNDS;
+	printf("%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+#include "bench_events.moc"
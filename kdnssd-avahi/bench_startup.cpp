@@ -0,0 +1,90 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+Measures how long DNS-SD holds up GUI thread when daemon is slow to start. Daemon is
+stood in by avahi_client_new() that does not return until given time after the first
+call. Both startup (prewarm, creating and starting browser and publisher) and longest
+stall of event loop until client is running have to stay well below that delay,
+waiting belongs to helper or avahi thread. Exits with 1 if they do not.
+
+Usage: bench_startup [delay in ms] [threaded]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <qapplication.h>
+#include <qdatetime.h>
+#include <kinstance.h>
+#include "responder.h"
+#include "servicebrowser.h"
+#include "publicservice.h"
+#include "benchclient.h"
+
+// tick of event loop watchdog in ms
+#define TICK 10
+
+using namespace DNSSD;
+
+// measures longest gap between timer events
+class Watchdog : public QObject
+{
+public:
+	Watchdog() : m_longest(0) { m_time.start(); startTimer(TICK); }
+	int m_longest;
+protected:
+	virtual void timerEvent(QTimerEvent*)
+	{
+		m_longest = QMAX(m_longest, m_time.restart()-TICK);
+	}
+private:
+	QTime m_time;
+};
+
+int main(int argc, char** argv)
+{
+	KInstance instance("bench_startup");
+	QApplication app(argc, argv, false);
+	int delay = (argc>1) ? atoi(argv[1]) : 500;
+	bool threaded = (argc>2 && !strcmp(argv[2],"threaded"));
+	setClientDelay(delay);
+	Responder::setThreaded(threaded);
+
+	QTime time;
+	time.start();
+	Responder::prewarm();
+	ServiceBrowser browser("_bench._tcp");
+	browser.startBrowse();
+	PublicService service("bench", "_bench._tcp", 4242);
+	service.publishAsync();
+	int startup = time.elapsed();
+
+	// first usable client, or connection attempt that failed
+	Watchdog watchdog;
+	while (Responder::self().state()!=AVAHI_CLIENT_S_RUNNING && !Responder::self().failed() &&
+		time.elapsed()<delay+10000) Responder::self().process(TICK);
+	int ready = time.elapsed();
+	bool running = Responder::self().state()==AVAHI_CLIENT_S_RUNNING;
+	printf("%s, daemon answers after %d ms: startup took %d ms, client %s after %d ms, "
+		"longest stall of event loop %d ms\n", threaded ? "threaded" : "event loop", delay,
+		startup, running ? "running" : "failed", ready, watchdog.m_longest);
+	bool ok = startup<delay/4+TICK && watchdog.m_longest<delay/4+TICK;
+	printf("%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
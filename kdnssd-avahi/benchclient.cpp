@@ -0,0 +1,87 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <config.h>
+
+#include <dlfcn.h>
+#include <unistd.h>
+#include <time.h>
+#include <avahi-client/client.h>
+#include "benchclient.h"
+
+namespace DNSSD
+{
+
+static uint created = 0;
+static int delay = 0;
+// when stand-in daemon starts answering, in ms of monotonic clock
+static long readyAt = -1;
+
+uint clientsCreated()
+{
+	return created;
+}
+
+void setClientDelay(int ms)
+{
+	delay = ms;
+}
+
+static long now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+// first connection starts daemon, every connection made before it is up waits
+static void wait()
+{
+	if (delay<=0) return;
+	if (readyAt<0) readyAt = now()+delay;
+	long left = readyAt-now();
+	if (left>0) usleep(left*1000);
+}
+
+}
+
+// called instead of avahi's own function, library is linked to benchmark dynamically
+#ifdef AVAHI_API_0_6
+AvahiClient* avahi_client_new(const AvahiPoll* poll, AvahiClientFlags flags,
+	AvahiClientCallback callback, void* userdata, int* error)
+{
+	typedef AvahiClient* (*ClientNew)(const AvahiPoll*, AvahiClientFlags, AvahiClientCallback,
+		void*, int*);
+	static ClientNew real = 0;
+	if (!real) real = (ClientNew)dlsym(RTLD_NEXT, "avahi_client_new");
+	DNSSD::created++;
+	DNSSD::wait();
+	return real(poll, flags, callback, userdata, error);
+}
+#else
+AvahiClient* avahi_client_new(const AvahiPoll* poll, AvahiClientCallback callback,
+	void* userdata, int* error)
+{
+	typedef AvahiClient* (*ClientNew)(const AvahiPoll*, AvahiClientCallback, void*, int*);
+	static ClientNew real = 0;
+	if (!real) real = (ClientNew)dlsym(RTLD_NEXT, "avahi_client_new");
+	DNSSD::created++;
+	DNSSD::wait();
+	return real(poll, callback, userdata, error);
+}
+#endif
@@ -0,0 +1,42 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DNSSDBENCHCLIENT_H
+#define DNSSDBENCHCLIENT_H
+
+#include <qglobal.h>
+
+namespace DNSSD
+{
+
+/*
+Helpers for benchmarks in this directory. They define avahi_client_new() and forward it
+to the real one, so benchmark can see how many client connections library opens and can
+stand in for daemon that is slow to answer.
+*/
+
+// number of avahi_client_new() calls since start
+uint clientsCreated();
+
+// makes daemon start answering given time after first avahi_client_new(), calls made
+// before that sleep until then
+void setClientDelay(int ms);
+
+}
+
+#endif
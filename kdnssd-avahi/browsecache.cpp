@@ -0,0 +1,93 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <qfile.h>
+#include <qdatastream.h>
+#include <kstandarddirs.h>
+#include <ksavefile.h>
+#include "browsecache.h"
+
+// "KDSC"
+#define CACHE_MAGIC 0x4b445343
+#define CACHE_VERSION 1
+// anything bigger is damaged file
+#define CACHE_MAX_SERVICES 100000
+
+namespace DNSSD
+{
+
+QString BrowseCache::fileName(const QString& type, const QString& domain)
+{
+	QString name = type+'@'+domain;
+	name.replace('/',"_");
+	return locateLocal("cache", "kdnssd/"+name);
+}
+
+QValueList<RemoteService::Ptr> BrowseCache::load(const QString& type, const QString& domain)
+{
+	QValueList<RemoteService::Ptr> services;
+	int fd = ::open(QFile::encodeName(fileName(type,domain)), O_RDONLY);
+	if (fd==-1) return services;
+	struct stat st;
+	void* data = MAP_FAILED;
+	if (!fstat(fd,&st) && st.st_size>0) data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data==MAP_FAILED) return services;
+
+	QByteArray bytes;
+	bytes.setRawData(static_cast<const char*>(data), st.st_size);
+	{
+		QDataStream s(bytes, IO_ReadOnly);
+		// Qt 3.3 format
+		s.setVersion(6);
+		Q_UINT32 magic, version, count;
+		s >> magic >> version >> count;
+		if (magic==CACHE_MAGIC && version==CACHE_VERSION && count<=CACHE_MAX_SERVICES)
+			for (Q_UINT32 i=0; i<count && !s.atEnd(); i++) {
+				RemoteService::Ptr svr = new RemoteService(QString::null, QString::null,
+					QString::null, -1, RemoteService::AnyProtocol, true);
+				s >> *svr;
+				if (svr->type().isEmpty()) break;
+				services.append(svr);
+			}
+	}
+	bytes.resetRawData(static_cast<const char*>(data), st.st_size);
+	munmap(data, st.st_size);
+	return services;
+}
+
+bool BrowseCache::save(const QString& type, const QString& domain,
+	const QValueList<RemoteService::Ptr>& services)
+{
+	KSaveFile file(fileName(type,domain), 0600);
+	if (file.status()) return false;
+	QDataStream s(file.file());
+	s.setVersion(6);
+	s << Q_UINT32(CACHE_MAGIC) << Q_UINT32(CACHE_VERSION) << Q_UINT32(services.count());
+	QValueList<RemoteService::Ptr>::ConstIterator itEnd = services.end();
+	for (QValueList<RemoteService::Ptr>::ConstIterator it = services.begin(); it!=itEnd; ++it)
+		s << *(*it);
+	return file.close();
+}
+
+}
@@ -0,0 +1,58 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DNSSDBROWSECACHE_H
+#define DNSSDBROWSECACHE_H
+
+#include <qvaluelist.h>
+#include "remoteservice.h"
+
+namespace DNSSD
+{
+
+/**
+Services found by ServiceBrowser saved on disk, one file per service type and domain. Saved
+services are shown right after start, before anything is heard from network.
+
+File starts with magic number and format version, followed by number of services and
+services themselves as written by RemoteService stream operator. It is written atomically
+and mapped into memory for reading.
+
+@short Internal on-disk cache of browse results
+ */
+class BrowseCache
+{
+public:
+	/**
+	Returns services saved for given type and domain, all marked as cached. Returns empty
+	list if there is no file or it is damaged or has different version.
+	 */
+	static QValueList<RemoteService::Ptr> load(const QString& type, const QString& domain);
+
+	/**
+	Replaces services saved for given type and domain
+	 */
+	static bool save(const QString& type, const QString& domain,
+		const QValueList<RemoteService::Ptr>& services);
+private:
+	static QString fileName(const QString& type, const QString& domain);
+};
+
+}
+
+#endif
@@ -22,6 +22,7 @@
 #include "domainbrowser.h"
 #include "settings.h"
 #include "sdevent.h"
+#include "eventqueue.h"
 #include "responder.h"
 #include "remoteservice.h"
 #include "query.h"
@@ -43,26 +44,61 @@ void domains_callback(AvahiDomainBrowser*,  AvahiIfIndex, AvahiProtocol, AvahiBr
 #endif
 
 
-class DomainBrowserPrivate 
+class DomainBrowserPrivate : public ClientObject
 {
 public:
-	DomainBrowserPrivate(DomainBrowser* owner) : m_browseLAN(false), m_started(false), 
-	    m_browser(0), m_owner(owner) {}
-	~DomainBrowserPrivate() { if (m_browser) avahi_domain_browser_free(m_browser); }
+	DomainBrowserPrivate(DomainBrowser* owner) : ClientObject(BrowserObject), m_browseLAN(false),
+	    m_started(false), m_browser(0), m_attached(false), m_responder(0), m_owner(owner), m_queue(owner) {}
+	~DomainBrowserPrivate() { stop(); }
 	QStringList m_domains;
-	virtual void customEvent(QCustomEvent* event);
 	bool m_browseLAN;
 	bool m_started;
 	AvahiDomainBrowser* m_browser;
+	bool m_attached;
+	Responder* m_responder;
 	DomainBrowser* m_owner;
+	AddRemoveQueue m_queue;
+	QValueVector<AddRemoveQueue::Entry> m_batch;
+
+	void stop() {
+	    if (m_attached) m_responder->detach(this);
+	    m_attached = false;
+	}
+	virtual bool create(AvahiClient* client);
+	virtual void destroy();
 };		
 
-void DomainBrowserPrivate::customEvent(QCustomEvent* event)
+bool DomainBrowserPrivate::create(AvahiClient* client)
+{
+#ifdef AVAHI_API_0_6
+	m_browser = avahi_domain_browser_new(client, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
+	    "local.", AVAHI_DOMAIN_BROWSER_BROWSE, (AvahiLookupFlags)0, domains_callback, &m_queue);
+#else
+	m_browser = avahi_domain_browser_new(client, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
+	    "local.", AVAHI_DOMAIN_BROWSER_BROWSE, domains_callback, &m_queue);
+#endif
+	if (m_browser) countObject(Statistics::Browsers,1);
+	return m_browser!=0;
+}
+
+void DomainBrowserPrivate::destroy()
+{
+	if (m_browser) {
+	    avahi_domain_browser_free(m_browser);
+	    countObject(Statistics::Browsers,-1);
+	}
+	m_browser = 0;
+}
+
+void DomainBrowser::customEvent(QCustomEvent* event)
 {
 	if (event->type()==QEvent::User+SD_ADDREMOVE) {
-		AddRemoveEvent *aev = static_cast<AddRemoveEvent*>(event);
-		if (aev->m_op==AddRemoveEvent::Add) m_owner->gotNewDomain(aev->m_domain);
-			else m_owner->gotRemoveDomain(aev->m_domain);
+		uint count = d->m_queue.take(d->m_batch);
+		for (uint i=0; i<count; i++) {
+			const AddRemoveQueue::Entry& e = d->m_batch[i];
+			if (e.m_op==AddRemoveEvent::Add) gotNewDomain(internDomain(e.m_domain));
+			if (e.m_op==AddRemoveEvent::Remove) gotRemoveDomain(internDomain(e.m_domain));
+		}
 	}
 }
 
@@ -97,17 +133,13 @@ void DomainBrowser::startBrowse()
 {
 	if (d->m_started) return;
 	d->m_started=true;
-	if (ServiceBrowser::isAvailable()!=ServiceBrowser::Working) return;
+	if (Responder::self().failed()) return;
  	QStringList::const_iterator itEnd = d->m_domains.end();
 	for (QStringList::const_iterator it=d->m_domains.begin(); it!=itEnd; ++it ) emit domainAdded(*it);
-	if (d->m_browseLAN) 
-#ifdef AVAHI_API_0_6
-	    d->m_browser = avahi_domain_browser_new(Responder::self().client(), AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
-		"local.", AVAHI_DOMAIN_BROWSER_BROWSE, (AvahiLookupFlags)0, domains_callback, this);
-#else
-	    d->m_browser = avahi_domain_browser_new(Responder::self().client(), AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
-		"local.", AVAHI_DOMAIN_BROWSER_BROWSE, domains_callback, this);
-#endif
+	if (d->m_browseLAN) {
+		d->m_responder = &Responder::pick(BrowserObject);
+		d->m_attached = d->m_responder->attach(d);
+	}
 }
 
 void DomainBrowser::gotNewDomain(const QString& domain)
@@ -128,10 +160,7 @@ void DomainBrowser::domainListChanged(int message,int)
 	if (message!=KIPCDomainsChanged) return;
 
 	bool was_started = d->m_started;
-	if (d->m_browser) { 
-	    avahi_domain_browser_free(d->m_browser);  // LAN query
-	    d->m_browser=0;
-	}
+	d->stop();  // LAN query
 	d->m_started = false;
 
 	// remove all domains and resolvers
@@ -171,11 +200,11 @@ void domains_callback(AvahiDomainBrowser*,  AvahiIfIndex, AvahiProtocol, AvahiBr
      void* context)
 #endif
 {
-	QObject *obj = reinterpret_cast<QObject*>(context);
-	AddRemoveEvent* arev=new AddRemoveEvent((event==AVAHI_BROWSER_NEW) ? AddRemoveEvent::Add :
-			AddRemoveEvent::Remove, QString::null, QString::null, 
-			DNSToDomain(replyDomain));
-		QApplication::postEvent(obj, arev);
+	countCallback();
+	AddRemoveQueue *queue = reinterpret_cast<AddRemoveQueue*>(context);
+	// other events do not change list of domains
+	if (event==AVAHI_BROWSER_NEW) queue->add(AddRemoveEvent::Add, 0, 0, replyDomain);
+	if (event==AVAHI_BROWSER_REMOVE) queue->add(AddRemoveEvent::Remove, 0, 0, replyDomain);
 }
 
 
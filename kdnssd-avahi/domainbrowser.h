@@ -89,6 +89,7 @@ signals:
 
 protected:
 	virtual void virtual_hook(int,void*);
+	virtual void customEvent(QCustomEvent* event);
 private:
 	friend class DomainBrowserPrivate;
 	DomainBrowserPrivate *d;
@@ -0,0 +1,310 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <qapplication.h>
+#include "eventqueue.h"
+#include "responder.h"
+
+#define CHUNK_SIZE 16
+// free AddRemoveEvents kept for reuse
+#define SPARE_EVENTS 64
+
+// full memory barrier and atomic exchange, used by lock-free AddRemoveQueue
+#define MEMORY_BARRIER() __sync_synchronize()
+#define EXCHANGE(ptr,value) __sync_lock_test_and_set(ptr,value)
+#define RELEASE(ptr) __sync_lock_release(ptr)
+
+namespace DNSSD
+{
+
+struct AddRemoveQueue::Chunk
+{
+	Chunk() : m_written(0), m_next(0) {}
+	AddRemoveQueue::Entry m_entries[CHUNK_SIZE];
+	volatile uint m_written;
+	Chunk* volatile m_next;
+};
+
+// events are created by avahi thread and deleted by GUI thread, so free list is
+// guarded by spin lock. It is held only for few instructions
+struct SpareEvent
+{
+	SpareEvent* m_next;
+};
+static SpareEvent* spareEvents = 0;
+static uint spareCount = 0;
+static volatile int spareLock = 0;
+
+void* AddRemoveEvent::operator new(size_t size)
+{
+	while (EXCHANGE(&spareLock,1)) ;
+	SpareEvent* e = spareEvents;
+	if (e) {
+		spareEvents = e->m_next;
+		spareCount--;
+	}
+	RELEASE(&spareLock);
+	return (e) ? (void*)e : ::operator new(size);
+}
+
+void AddRemoveEvent::operator delete(void* p)
+{
+	if (!p) return;
+	while (EXCHANGE(&spareLock,1)) ;
+	bool keep = spareCount<SPARE_EVENTS;
+	if (keep) {
+		SpareEvent* e = static_cast<SpareEvent*>(p);
+		e->m_next = spareEvents;
+		spareEvents = e;
+		spareCount++;
+	}
+	RELEASE(&spareLock);
+	if (!keep) ::operator delete(p);
+}
+
+// returns false if src does not fit
+static bool copyString(char* dest, const char* src, uint size)
+{
+	if (!src) {
+		dest[0] = 0;
+		return true;
+	}
+	uint len = qstrlen(src);
+	if (len>=size) return false;
+	memcpy(dest, src, len+1);
+	return true;
+}
+
+AddRemoveQueue::AddRemoveQueue(QObject* receiver) : m_receiver(receiver), m_headIndex(0),
+	m_spare(0), m_wakeup(0)
+{
+	m_head = m_tail = new Chunk;
+}
+
+AddRemoveQueue::~AddRemoveQueue()
+{
+	while (m_head) {
+		Chunk* next = m_head->m_next;
+		delete m_head;
+		m_head = next;
+	}
+	delete m_spare;
+}
+
+void AddRemoveQueue::add(AddRemoveEvent::Operation op, const char* name, const char* type,
+	const char* domain, int interface, int protocol, bool cached)
+{
+	if (m_tail->m_written==CHUNK_SIZE) {
+		Chunk* c = EXCHANGE(&m_spare,(Chunk*)0);
+		if (c) {
+			c->m_written = 0;
+			c->m_next = 0;
+		} else c = new Chunk;
+		MEMORY_BARRIER();
+		m_tail->m_next = c;
+		m_tail = c;
+	}
+	Entry& e = m_tail->m_entries[m_tail->m_written];
+	e.m_op = op;
+	e.m_interface = interface;
+	e.m_protocol = protocol;
+	e.m_cached = cached;
+	// truncated names could make different instances look the same, slot is reused
+	if (!copyString(e.m_name, name, sizeof(e.m_name)) ||
+		!copyString(e.m_type, type, sizeof(e.m_type)) ||
+		!copyString(e.m_domain, domain, sizeof(e.m_domain))) return;
+	// entry has to be complete before consumer can see it
+	MEMORY_BARRIER();
+	m_tail->m_written++;
+	if (!EXCHANGE(&m_wakeup,1)) {
+		QApplication::postEvent(m_receiver, new AddRemoveEvent());
+		countEvent();
+	}
+}
+
+uint AddRemoveQueue::take(QValueVector<Entry>& batch)
+{
+	// anything added after this point will post new wake-up event
+	EXCHANGE(&m_wakeup,0);
+	MEMORY_BARRIER();
+	uint n = 0;
+	for (;;) {
+		uint written = m_head->m_written;
+		MEMORY_BARRIER();
+		while (m_headIndex<written) {
+			if (n==batch.size()) batch.resize(n ? 2*n : CHUNK_SIZE);
+			batch[n++] = m_head->m_entries[m_headIndex++];
+		}
+		if (m_headIndex<CHUNK_SIZE || !m_head->m_next) break;
+		Chunk* drained = m_head;
+		m_head = m_head->m_next;
+		m_headIndex = 0;
+		delete EXCHANGE(&m_spare,drained);
+	}
+
+	if (m_dropped.size()<n) {
+		m_dropped.resize(n);
+		m_previous.resize(n);
+	}
+	// at most half full
+	uint tableSize = CHUNK_SIZE;
+	while (tableSize<2*n) tableSize*=2;
+	if (m_slots.size()!=tableSize) m_slots.resize(tableSize);
+	clearSlots();
+	for (uint i=0; i<n; i++) {
+		m_dropped[i] = false;
+		if (batch[i].m_op==AddRemoveEvent::Reset) {
+			// nothing before reset can be paired
+			clearSlots();
+			continue;
+		}
+		Slot& s = slot(batch,i);
+		int latest = s.m_latest;
+		if (batch[i].m_op==AddRemoveEvent::Remove && latest>=0 &&
+			batch[latest].m_op==AddRemoveEvent::Add) {
+			m_dropped[i] = m_dropped[latest] = true;
+			s.m_latest = m_previous[latest];
+			continue;
+		}
+		m_previous[i] = latest;
+		s.m_latest = i;
+	}
+
+	uint count = 0;
+	for (uint i=0; i<n; i++) {
+		if (m_dropped[i]) continue;
+		if (i!=count) batch[count] = batch[i];
+		count++;
+	}
+	return count;
+}
+
+void AddRemoveQueue::clearSlots()
+{
+	uint size = m_slots.size();
+	for (uint i=0; i<size; i++) m_slots[i].m_key = -1;
+}
+
+static inline uint hashString(uint h, const char* s)
+{
+	// FNV-1a
+	for ( ; *s; s++) h = (h^(unsigned char)*s)*16777619u;
+	return h*16777619u;
+}
+
+static inline bool sameInstance(const AddRemoveQueue::Entry& a, const AddRemoveQueue::Entry& b)
+{
+	return a.m_interface==b.m_interface && a.m_protocol==b.m_protocol &&
+		!qstrcmp(a.m_name,b.m_name) && !qstrcmp(a.m_type,b.m_type) &&
+		!qstrcmp(a.m_domain,b.m_domain);
+}
+
+// returns slot of instance described by batch[index], claiming empty one if it is not there
+AddRemoveQueue::Slot& AddRemoveQueue::slot(const QValueVector<Entry>& batch, int index)
+{
+	const Entry& e = batch[index];
+	uint h = 2166136261u^(uint)(e.m_interface*4+(e.m_protocol & 3));
+	h = hashString(hashString(hashString(h,e.m_name),e.m_type),e.m_domain);
+	uint mask = m_slots.size()-1;
+	for (uint i = h & mask; ; i = (i+1) & mask) {
+		Slot& s = m_slots[i];
+		if (s.m_key<0) {
+			s.m_key = index;
+			s.m_latest = -1;
+			return s;
+		}
+		if (sameInstance(batch[s.m_key],e)) return s;
+	}
+}
+
+StringPool::StringPool(uint limit, uint size) : m_strings(size, true, false),
+	m_first(0), m_last(0), m_limit(limit)
+{
+}
+
+StringPool::~StringPool()
+{
+	while (m_first) {
+		Node* next = m_first->m_next;
+		delete m_first;
+		m_first = next;
+	}
+}
+
+void StringPool::unlink(Node* node)
+{
+	if (node->m_prev) node->m_prev->m_next = node->m_next;
+		else m_first = node->m_next;
+	if (node->m_next) node->m_next->m_prev = node->m_prev;
+		else m_last = node->m_prev;
+}
+
+void StringPool::pushFront(Node* node)
+{
+	node->m_prev = 0;
+	node->m_next = m_first;
+	if (m_first) m_first->m_prev = node;
+	m_first = node;
+	if (!m_last) m_last = node;
+}
+
+QString StringPool::intern(const char* utf8, bool isDomain)
+{
+	if (!utf8 || !utf8[0]) return QString::null;
+	Node* node = m_strings.find(utf8);
+	if (node) {
+		if (node!=m_first) {
+			unlink(node);
+			pushFront(node);
+		}
+		return node->m_string;
+	}
+	if (m_strings.count()>=m_limit) {
+		// reuse least recently used node
+		node = m_last;
+		m_strings.remove(node->m_utf8);
+		unlink(node);
+	} else node = new Node;
+	node->m_utf8 = utf8;
+	node->m_string = isDomain ? DNSToDomain(utf8) : QString::fromUtf8(utf8);
+	m_strings.insert(node->m_utf8, node);
+	pushFront(node);
+	return node->m_string;
+}
+
+// names are numerous, keep pool for them bounded
+static StringPool namePool(4096,4099);
+static StringPool typePool(512,521);
+static StringPool domainPool(64,67);
+
+QString internName(const char* name)
+{
+	return namePool.intern(name);
+}
+
+QString internType(const char* type)
+{
+	return typePool.intern(type);
+}
+
+QString internDomain(const char* domain)
+{
+	return domainPool.intern(domain,true);
+}
+
+}
@@ -0,0 +1,160 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DNSSDEVENTQUEUE_H
+#define DNSSDEVENTQUEUE_H
+
+#include <qstring.h>
+#include <qasciidict.h>
+#include <qvaluevector.h>
+#include <avahi-common/domain.h>
+#include "sdevent.h"
+
+class QObject;
+namespace DNSSD
+{
+
+/**
+Queue of browser events waiting for delivery to one receiver. Avahi callbacks append
+to it and only the first event of a batch posts AddRemoveEvent to wake the receiver up,
+which then drains everything collected so far with take().
+
+Entries keep raw names as received from avahi in fixed size buffers, so slots are
+reused and appending does not allocate. Buffers are as big as DNS allows and events with
+longer names are dropped rather than truncated. Receiver converts names to QStrings
+with internName(), internType() and internDomain(). Wake-up events are recycled, see
+AddRemoveEvent.
+
+Queue is safe for one producer thread (avahi callbacks) and one consumer thread
+(receiver) without locking. Entries are stored in linked chunks; producer only links
+new chunks and consumer only unlinks drained ones.
+
+@short Internal per-receiver queue of add/remove events
+ */
+class AddRemoveQueue
+{
+public:
+	struct Entry
+	{
+		AddRemoveEvent::Operation m_op;
+		// avahi interface index and protocol
+		int m_interface;
+		int m_protocol;
+		// result came from daemon's cache (AVAHI_LOOKUP_RESULT_CACHED)
+		bool m_cached;
+		// service name is single label, type and domain are escaped domain names
+		char m_name[AVAHI_LABEL_MAX];
+		char m_type[AVAHI_DOMAIN_NAME_MAX];
+		char m_domain[AVAHI_DOMAIN_NAME_MAX];
+	};
+
+	AddRemoveQueue(QObject* receiver);
+	~AddRemoveQueue();
+
+	/**
+	Appends event. Called from avahi callbacks. Any of strings may be null. Event is
+	dropped if any of them does not fit into its buffer, such names are not valid in DNS.
+	 */
+	void add(AddRemoveEvent::Operation op, const char* name, const char* type,
+		const char* domain, int interface=-1, int protocol=-1, bool cached=false);
+
+	/**
+	Moves all pending entries into batch and returns their count. Addition followed
+	by removal of the same instance on the same interface and protocol inside one
+	batch is dropped. Instances are found by hashing, so bursts take linear time.
+	Batch is never shrunk, so it can be reused between calls.
+	 */
+	uint take(QValueVector<Entry>& batch);
+
+private:
+	struct Chunk;
+
+	QObject* m_receiver;
+	// written only by producer
+	Chunk* m_tail;
+	// written only by consumer
+	Chunk* m_head;
+	uint m_headIndex;
+	QValueVector<bool> m_dropped;
+	// open addressing table of instances in batch, reused between calls of take()
+	struct Slot
+	{
+		// some entry of the instance, -1 for empty slot
+		int m_key;
+		// its latest event that was not dropped, -1 if none
+		int m_latest;
+	};
+	QValueVector<Slot> m_slots;
+	// previous event of the same instance that was not dropped, for each entry
+	QValueVector<int> m_previous;
+	void clearSlots();
+	Slot& slot(const QValueVector<Entry>& batch, int index);
+	// drained chunk handed back to producer for reuse
+	Chunk* volatile m_spare;
+	volatile int m_wakeup;
+};
+
+/**
+Set of shared strings indexed by their UTF-8 form. Strings returned by intern() share
+data, so looking up string that was seen before does not allocate. When number of
+strings reaches limit, the least recently used one is replaced.
+
+@short Internal string interning table
+ */
+class StringPool
+{
+public:
+	/**
+	@param limit Maximum number of strings kept
+	@param size Number of hash buckets, prime number close to limit
+	 */
+	StringPool(uint limit, uint size);
+	~StringPool();
+
+	/**
+	Returns shared string for given UTF-8 data. When isDomain is set, data is treated as
+	DNS domain name and converted with DNSToDomain(). Returned copy stays valid when
+	string is evicted from pool.
+	 */
+	QString intern(const char* utf8, bool isDomain=false);
+private:
+	struct Node
+	{
+		QCString m_utf8;
+		QString m_string;
+		// recently used list, most recent first
+		Node* m_prev;
+		Node* m_next;
+	};
+	void unlink(Node* node);
+	void pushFront(Node* node);
+
+	// keys point to m_utf8 of nodes
+	QAsciiDict<Node> m_strings;
+	Node* m_first;
+	Node* m_last;
+	uint m_limit;
+};
+
+QString internName(const char* name);
+QString internType(const char* type);
+QString internDomain(const char* domain);
+
+}
+
+#endif
@@ -0,0 +1,143 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+Checks AddRemoveQueue: cancelling of addition followed by removal, entries spanning
+several chunks and reuse of drained ones, and wake-up events.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <qapplication.h>
+#include <qvaluevector.h>
+#include <kinstance.h>
+#include "eventqueue.h"
+
+using namespace DNSSD;
+
+static int failures = 0;
+
+static void check(const char* what, bool ok)
+{
+	printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) failures++;
+}
+
+// counts wake-up events
+class Receiver : public QObject
+{
+public:
+	Receiver() : m_wakeups(0) {}
+	uint m_wakeups;
+protected:
+	virtual void customEvent(QCustomEvent* event)
+	{
+		if (event->type()==QEvent::User+SD_ADDREMOVE) m_wakeups++;
+	}
+};
+
+static bool isEntry(const AddRemoveQueue::Entry& e, AddRemoveEvent::Operation op,
+	const char* name, int interface=1)
+{
+	return e.m_op==op && !strcmp(e.m_name,name) && e.m_interface==interface;
+}
+
+static void add(AddRemoveQueue& queue, AddRemoveEvent::Operation op, const char* name,
+	int interface=1)
+{
+	queue.add(op, name, "_test._tcp", "local", interface, 0);
+}
+
+int main(int argc, char** argv)
+{
+	KInstance instance("eventqueuetest");
+	QApplication app(argc, argv, false);
+	Receiver receiver;
+	AddRemoveQueue queue(&receiver);
+	QValueVector<AddRemoveQueue::Entry> batch;
+
+	add(queue, AddRemoveEvent::Add, "a");
+	add(queue, AddRemoveEvent::Remove, "a");
+	check("addition cancelled by removal", queue.take(batch)==0);
+
+	add(queue, AddRemoveEvent::Add, "a");
+	add(queue, AddRemoveEvent::Remove, "a");
+	add(queue, AddRemoveEvent::Add, "a");
+	uint n = queue.take(batch);
+	check("addition after cancelled pair kept", n==1 && isEntry(batch[0], AddRemoveEvent::Add, "a"));
+
+	add(queue, AddRemoveEvent::Remove, "a");
+	add(queue, AddRemoveEvent::Add, "a");
+	n = queue.take(batch);
+	check("removal followed by addition kept", n==2 &&
+		isEntry(batch[0], AddRemoveEvent::Remove, "a") && isEntry(batch[1], AddRemoveEvent::Add, "a"));
+
+	add(queue, AddRemoveEvent::Add, "a", 1);
+	add(queue, AddRemoveEvent::Remove, "a", 2);
+	n = queue.take(batch);
+	check("other interface does not cancel", n==2);
+
+	add(queue, AddRemoveEvent::Add, "a");
+	add(queue, AddRemoveEvent::Add, "b");
+	add(queue, AddRemoveEvent::Remove, "a");
+	n = queue.take(batch);
+	check("other instances keep their order", n==1 && isEntry(batch[0], AddRemoveEvent::Add, "b"));
+
+	add(queue, AddRemoveEvent::Add, "a");
+	queue.add(AddRemoveEvent::Reset, 0, 0, 0);
+	add(queue, AddRemoveEvent::Remove, "a");
+	n = queue.take(batch);
+	check("nothing is paired across reset", n==3 && batch[1].m_op==AddRemoveEvent::Reset);
+
+	char name[AVAHI_LABEL_MAX+10];
+	memset(name, 'x', sizeof(name)-1);
+	name[sizeof(name)-1] = 0;
+	add(queue, AddRemoveEvent::Add, name);
+	check("too long name dropped", queue.take(batch)==0);
+
+	// several chunks, then again with drained chunk reused
+	for (int round=0; round<2; round++) {
+		const uint count = 100;
+		char names[count][8];
+		for (uint i=0; i<count; i++) {
+			snprintf(names[i], sizeof(names[i]), "s%u", i);
+			add(queue, AddRemoveEvent::Add, names[i]);
+		}
+		n = queue.take(batch);
+		bool inOrder = n==count;
+		for (uint i=0; inOrder && i<count; i++)
+			inOrder = isEntry(batch[i], AddRemoveEvent::Add, names[i]);
+		check(round ? "chunks reused" : "entries spanning chunks", inOrder);
+		for (uint i=0; i<count; i++) add(queue, AddRemoveEvent::Remove, names[i]);
+		check("removals spanning chunks", queue.take(batch)==count);
+	}
+
+	QApplication::sendPostedEvents(&receiver, 0);
+	receiver.m_wakeups = 0;
+	add(queue, AddRemoveEvent::Add, "a");
+	add(queue, AddRemoveEvent::Add, "b");
+	QApplication::sendPostedEvents(&receiver, 0);
+	check("one wake-up per batch", receiver.m_wakeups==1);
+	queue.take(batch);
+	add(queue, AddRemoveEvent::Add, "c");
+	QApplication::sendPostedEvents(&receiver, 0);
+	check("wake-up after take", receiver.m_wakeups==2);
+
+	printf("%s\n", failures ? "FAIL" : "PASS");
+	return failures ? 1 : 0;
+}
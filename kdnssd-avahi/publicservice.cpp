@@ -27,6 +27,7 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <qapplication.h>
+#include <qdatetime.h>
 #include <ksocketaddress.h>
 #include <kurl.h>
 #include <unistd.h>
@@ -47,19 +48,48 @@ static unsigned long publicIP();
 
 void publish_callback (AvahiEntryGroup*, AvahiEntryGroupState s,  void *context);
 
-class PublicServicePrivate 
+class PublicServicePrivate : public ClientObject
 {
 public:
-	PublicServicePrivate() : m_published(false), m_running(false), m_collision(false)
+	PublicServicePrivate(PublicService* owner) : ClientObject(PublisherObject), m_published(false),
+	    m_running(false), m_collision(false), m_attached(false), m_started(0), m_created(false), m_group(0),
+	    m_owner(owner), m_responder(0)
 	{}
 	bool m_published;
 	bool m_running;
 	bool m_collision;
+	bool m_attached;
+	// timestamp of publishAsync()
+	uint m_started;
+	// create() was already called. Guarded by client lock
+	bool m_created;
 	AvahiEntryGroup* m_group;
+	QStringList m_subtypes;
+	PublicService* m_owner;
+	Responder* m_responder;
 	void commit()
 	{
 	    if (!m_collision) avahi_entry_group_commit(m_group);
 	}    
+	virtual bool create(AvahiClient* client)
+	{
+	    m_created = true;
+	    m_group = avahi_entry_group_new(client, publish_callback, m_owner);
+	    if (m_group) countObject(Statistics::EntryGroups,1);
+	    // publishAsync() may be waiting for the group
+	    if (m_responder->isThreaded()) 
+		QApplication::postEvent(m_owner, new ClientStateEvent(avahi_client_get_state(client)));
+	    return m_group!=0;
+	}
+	virtual void destroy()
+	{
+	    if (m_group) {
+		avahi_entry_group_free(m_group);
+		countObject(Statistics::EntryGroups,-1);
+	    }
+	    m_group = 0;
+	    m_created = false;
+	}
 	
 };
 
@@ -67,10 +97,10 @@ PublicService::PublicService(const QString& name, const QString& type, unsigned
 			      const QString& domain)
   		: QObject(), ServiceBase(name, type, QString::null, domain, port)
 {
-	d = new PublicServicePrivate;
-	if (Responder::self().client()) d->m_group = avahi_entry_group_new(Responder::self().client(),
-	    publish_callback,this);
-	connect(&Responder::self(),SIGNAL(stateChanged(AvahiClientState)),this,SLOT(clientState(AvahiClientState)));
+	d = new PublicServicePrivate(this);
+	d->m_responder = &Responder::pick(PublisherObject);
+	d->m_attached = d->m_responder->attach(d);
+	connect(d->m_responder,SIGNAL(stateChanged(AvahiClientState)),this,SLOT(clientState(AvahiClientState)));
 	if (domain.isNull())
 		if (Configuration::publishType()==Configuration::EnumPublishType::LAN) m_domain="local.";
 		else m_domain=Configuration::publishDomain();
@@ -79,14 +109,25 @@ PublicService::PublicService(const QString& name, const QString& type, unsigned
 
 PublicService::~PublicService()
 {
-	if (d->m_group) avahi_entry_group_free(d->m_group);
+	if (d->m_attached) d->m_responder->detach(d);
 	delete d;
 }
 
 void PublicService::tryApply()
 {
-    if (fillEntryGroup()) d->commit();
-    else {
+    d->m_responder->lock();
+    if (!d->m_group && !d->m_created) {
+	// group is not created yet (or connection was lost), apply when it is
+	d->m_responder->unlock();
+	d->m_collision = true;
+	return;
+    }
+    bool ok = d->m_group!=0;
+    if (ok) avahi_entry_group_reset(d->m_group);
+    ok = ok && fillEntryGroup();
+    if (ok) d->commit();
+    d->m_responder->unlock();
+    if (!ok) {
 	stop();
 	emit published(false);
     }
@@ -95,47 +136,43 @@ void PublicService::tryApply()
 void PublicService::setServiceName(const QString& serviceName)
 {
 	m_serviceName = serviceName;
-	if (d->m_running) {
-	    avahi_entry_group_reset(d->m_group);
-	    tryApply();
-	} 
+	if (d->m_running) tryApply();
 }
 
 void PublicService::setDomain(const QString& domain)
 {
 	m_domain = domain;
-	if (d->m_running) {
-	    avahi_entry_group_reset(d->m_group);
-	    tryApply();
-	} 
+	if (d->m_running) tryApply();
 }
 
 
 void PublicService::setType(const QString& type)
 {
 	m_type = type;
-	if (d->m_running) {
-	    avahi_entry_group_reset(d->m_group);
-	    tryApply();
-	} 
+	if (d->m_running) tryApply();
 }
 
 void PublicService::setPort(unsigned short port)
 {
 	m_port = port;
-	if (d->m_running) {
-	    avahi_entry_group_reset(d->m_group);
-	    tryApply();
-    	} 
+	if (d->m_running) tryApply();
 }
 
 void PublicService::setTextData(const QMap<QString,QString>& textData)
 {
 	m_textData = textData;
-	if (d->m_running) {
-	    avahi_entry_group_reset(d->m_group);
-	    tryApply();
-	} 
+	if (d->m_running) tryApply();
+}
+
+void PublicService::setSubtypes(const QStringList& subtypes)
+{
+	d->m_subtypes = subtypes;
+	if (d->m_running) tryApply();
+}
+
+const QStringList& PublicService::subtypes() const
+{
+	return d->m_subtypes;
 }
 
 bool PublicService::isPublished() const
@@ -145,15 +182,45 @@ bool PublicService::isPublished() const
 
 bool PublicService::publish()
 {
+	return publish(-1)==PublishSuccess;
+}
+
+PublicService::PublishResult PublicService::publish(int timeout)
+{
+	QTime time;
+	time.start();
 	publishAsync();
-	while (d->m_running && !d->m_published) Responder::self().process();
-	return d->m_published;
+	while (d->m_running && !d->m_published) {
+		// do not wait for daemon to come back
+		if (d->m_responder->failed()) {
+			// clientState() reports lost connection, in threaded mode its event may
+			// still be pending. Lock waits until client callback has posted it
+			d->m_responder->lock();
+			d->m_responder->unlock();
+			QApplication::sendPostedEvents(d->m_responder, QEvent::User+SD_STATE);
+			stop();
+			return PublishFailure;
+		}
+		int left = timeout-time.elapsed();
+		if (timeout>=0 && left<=0) {
+			stop();
+			// asynchronous listeners learn about it too
+			emit published(false);
+			return PublishTimeout;
+		}
+		Responder::self().process((timeout>=0) ? left : -1);
+	}
+	return (d->m_published) ? PublishSuccess : PublishFailure;
 }
 
 void PublicService::stop()
 {
-    if (d->m_group) avahi_entry_group_reset(d->m_group);
+    if (d->m_attached) {
+	ClientLocker lock(*d->m_responder);
+	if (d->m_group) avahi_entry_group_reset(d->m_group);
+    }
     d->m_published = false;
+    d->m_running = false;
 }
 bool PublicService::fillEntryGroup()
 {
@@ -162,12 +229,18 @@ bool PublicService::fillEntryGroup()
     for (QMap<QString,QString>::ConstIterator it = m_textData.begin(); it!=itEnd ; ++it) 
 	s = avahi_string_list_add_pair(s, it.key().utf8(),it.data().utf8());
 #ifdef AVAHI_API_0_6
+    QCString name = m_serviceName.isNull() ? QCString(avahi_client_get_host_name(d->m_responder->client())) :
+	m_serviceName.utf8();
+    QCString domain = domainToDNS(m_domain);
     bool res = (!avahi_entry_group_add_service_strlst(d->m_group, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, (AvahiPublishFlags)0, 
-	m_serviceName.isNull() ? avahi_client_get_host_name(Responder::self().client()) : m_serviceName.utf8().data(),
-	m_type.ascii(),domainToDNS(m_domain),m_hostName.utf8(),m_port,s));
+	name, m_type.ascii(),domain,m_hostName.utf8(),m_port,s));
+    QStringList::ConstIterator subEnd = d->m_subtypes.end();
+    for (QStringList::ConstIterator sub = d->m_subtypes.begin(); res && sub!=subEnd; ++sub)
+	res = (!avahi_entry_group_add_service_subtype(d->m_group, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
+	    (AvahiPublishFlags)0, name, m_type.ascii(), domain, subtypeName(*sub,m_type).ascii()));
 #else
     bool res = (!avahi_entry_group_add_service_strlst(d->m_group, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 
-	m_serviceName.isNull() ? avahi_client_get_host_name(Responder::self().client()) : m_serviceName.utf8().data(),
+	m_serviceName.isNull() ? avahi_client_get_host_name(d->m_responder->client()) : m_serviceName.utf8().data(),
 	m_type.ascii(),m_domain.utf8(),m_hostName.utf8(),m_port,s));
 #endif
     avahi_string_list_free(s);
@@ -184,12 +257,17 @@ void PublicService::clientState(AvahiClientState s)
 	case AVAHI_CLIENT_S_INVALID:
 	case AVAHI_CLIENT_DISCONNECTED:
 #endif
-	    stop();
+	    // entry group is gone with the connection. Responder creates new one after 
+	    // reconnecting and service is published again when client is running
+	    d->m_collision=true;
+	    d->m_published=false;
 	    emit published(false);
 	    break;
 	case AVAHI_CLIENT_S_REGISTERING:
 	case AVAHI_CLIENT_S_COLLISION:
-	    avahi_entry_group_reset(d->m_group);
+	    d->m_responder->lock();
+	    if (d->m_group) avahi_entry_group_reset(d->m_group);
+	    d->m_responder->unlock();
 	    d->m_collision=true;
 	    break;
 	case AVAHI_CLIENT_S_RUNNING:
@@ -204,11 +282,14 @@ void PublicService::publishAsync()
 {
 	if (d->m_running) stop();
 	
-	if (!d->m_group) {
+	// service created while daemon was down
+	if (!d->m_attached) d->m_attached = d->m_responder->attach(d);
+	if (!d->m_attached || d->m_responder->failed()) {
 	    emit published(false);
 	    return;
 	}
-	AvahiClientState s=avahi_client_get_state(Responder::self().client());
+	d->m_started = timestamp();
+	AvahiClientState s=d->m_responder->state();
 	d->m_running=true; 
 	d->m_collision=true; // make it look like server is getting out of collision to force registering
 	clientState(s);
@@ -216,10 +297,12 @@ void PublicService::publishAsync()
 
 void publish_callback (AvahiEntryGroup*, AvahiEntryGroupState s,  void *context)
 {
+	countCallback();
 	QObject *obj = reinterpret_cast<QObject*>(context);
 	if (s!=AVAHI_ENTRY_GROUP_ESTABLISHED && s!=AVAHI_ENTRY_GROUP_COLLISION) return;
 	PublishEvent* pev=new PublishEvent(s==AVAHI_ENTRY_GROUP_ESTABLISHED);
 	QApplication::postEvent(obj, pev);
+	countEvent();
 }
 
 const KURL PublicService::toInvitation(const QString& host)
@@ -244,12 +327,16 @@ const KURL PublicService::toInvitation(const QString& host)
 
 void PublicService::customEvent(QCustomEvent* event)
 {
+	if (event->type()==QEvent::User+SD_STATE) clientState(static_cast<ClientStateEvent*>(event)->m_state);
 	if (event->type()==QEvent::User+SD_PUBLISH) {
 		if (!static_cast<PublishEvent*>(event)->m_ok) {
 		    setServiceName(QString::fromUtf8(avahi_alternative_service_name(m_serviceName.utf8())));
 		    return;
 		}
 		d->m_published=true;
+		if (d->m_started) recordLatency(Statistics::Publish, d->m_started);
+		// re-announcements are not measured
+		d->m_started = 0;
 		emit published(true);
 	}
 }
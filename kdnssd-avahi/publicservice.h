@@ -22,6 +22,7 @@
 #define DNSSDPUBLICSERVICE_H
 
 #include <qobject.h>
+#include <qstringlist.h>
 #include <dnssd/servicebase.h>
 #include <avahi-client/client.h>
 
@@ -77,11 +78,26 @@ public:
 	 */
 	void stop();
 	
+	/**
+	Result of synchronous publishing
+	@li PublishSuccess - service has been published
+	@li PublishFailure - service could not be published
+	@li PublishTimeout - publishing was not complete until deadline and has been aborted
+	 */
+	enum PublishResult { PublishSuccess, PublishFailure, PublishTimeout };
+
 	/**
 	Synchrounous publish. Application will be freezed until publishing is complete.
 	@return true if successfull.
 	 */
 	bool publish();
+
+	/**
+	Synchronous publish that gives up after timeout. Application sleeps until
+	publishing is complete, so it does not use CPU while waiting.
+	@param timeout Maximum time to wait in milliseconds, negative value means no limit
+	 */
+	PublishResult publish(int timeout);
 	
 	/**
 	Returns true is currently published
@@ -121,6 +137,19 @@ public:
 	published, it will be re-announced with new data.
 	 */
 	void setDomain(const QString& domain);
+
+	/**
+	Sets subtypes service is registered with, for example "_printer" for "_http._tcp"
+	service. Clients browsing for a subtype find only services registered with it. If
+	service is currently published, it will be re-announced with new data. Requires
+	avahi 0.6 or newer, otherwise subtypes are ignored.
+	 */
+	void setSubtypes(const QStringList& subtypes);
+
+	/**
+	Returns subtypes set with setSubtypes()
+	 */
+	const QStringList& subtypes() const;
 	
 	/**
 	Translates service into URL that can be sent to another user. 
@@ -133,7 +162,9 @@ public:
 signals:
 	/**
 	Emitted when publishing is complete - parameter is set to true if it was successfull. It will also
-	emitted when name, port or type of already published service is changed.
+	emitted when name, port or type of already published service is changed. When connection to
+	daemon is lost, it is emitted with false and service is published again after reconnection,
+	unless stop() is called.
 	*/
 	void published(bool);
 private:
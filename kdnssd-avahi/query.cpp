@@ -22,69 +22,130 @@
 #include "responder.h"
 #include "remoteservice.h"
 #include "sdevent.h"
-#include <qdatetime.h>
+#include "sharedbrowser.h"
+#include "servicerecord.h"
+#include "recordtable.h"
 #include <qapplication.h>
-#include <qtimer.h>
-
-#include <avahi-client/client.h>
-#ifdef AVAHI_API_0_6
-#include <avahi-client/lookup.h>
-#endif
-
-#define TIMEOUT_LAN 200
+#include <qvaluevector.h>
+#include <qguardedptr.h>
+#include <avahi-common/address.h>
 
 namespace DNSSD
 {
-#ifdef AVAHI_API_0_6
-
-void services_callback(AvahiServiceBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent event, const char* name,
-    const char* regtype, const char* domain, AvahiLookupResultFlags, void* context);
-void types_callback(AvahiServiceTypeBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent event, const char* regtype,
-    const char* replyDomain, AvahiLookupResultFlags, void* context);
-#else
-void services_callback(AvahiServiceBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent event, const char* name,
-    const char* regtype, const char* domain, void* context);
-void types_callback(AvahiServiceTypeBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent event, const char* regtype,
-    const char* replyDomain, void* context);
-void domains_callback(AvahiDomainBrowser*,  AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent event, const char* replyDomain,
-     void* context);
-#endif
-
-enum BrowserType { Types, Services };
 
-class QueryPrivate 
+class QueryPrivate
 {
 public:
-	QueryPrivate(const QString& type, const QString& domain) : m_finished(false), m_browser(0),
-	m_running(false), m_domain(domain), m_type(type) {}
+	QueryPrivate(const QString& type, const QString& domain) : m_finished(false), m_running(false),
+	m_cacheOnly(false), m_cacheExhausted(false), m_domain(domain), m_type(type), m_protocol(RemoteService::AnyProtocol), m_instances(127),
+	m_started(0), m_gotResult(false), m_resync(false) {}
 
 	bool m_finished;
-	BrowserType m_browserType;
-	void* m_browser;
 	bool m_running;
+	bool m_cacheOnly;
+	bool m_cacheExhausted;
 	QString m_domain;
-	QTimer timeout;
 	QString m_type;
+	QValueList<int> m_interfaces;
+	RemoteService::Protocol m_protocol;
+	// one browser per interface
+	QPtrList<SharedBrowser> m_browsers;
+	// interfaces whose browsers have not finished yet
+	QValueList<int> m_unfinished;
+	// interfaces whose browsers have not exhausted cache yet
+	QValueList<int> m_uncached;
+	struct Instance
+	{
+		Instance* m_next;
+		uint m_hash;
+		// interfaces and protocols instance is seen on, see sighting(). Empty for
+		// instances reported before stop() and not seen since. Capacity is kept when
+		// record is reused
+		QValueVector<int> m_sightings;
+		ServiceRecord m_record;
+		bool matches(const QString& key) const
+		{
+			return key==(m_record.serviceName().isEmpty() ? m_record.type() :
+				m_record.serviceName());
+		}
+	};
+	// all reported instances, see instanceKey()
+	RecordTable<Instance> m_instances;
+	// timestamp of startQuery()
+	uint m_started;
+	bool m_gotResult;
+	// query was restarted, instances not seen again have to be reported as removed
+	bool m_resync;
 };
 
+// instances are keyed by name, or by type when browsing for types. Type and domain are
+// the same for all names in one query
+static inline const QString& instanceKey(const ServiceEvent* ev)
+{
+	return (ev->m_name.isEmpty()) ? ev->m_type : ev->m_name;
+}
+
+// one number for interface and protocol (which is -1, 0 or 1)
+static inline int sighting(const ServiceEvent* ev)
+{
+	return ev->m_interface*4+(ev->m_protocol & 3);
+}
+
+// receivers() with signal name normalizes it into new string on every call, so signals
+// checked for each instance are looked up by index
+static int serviceAddedSignal = -1;
+static int serviceRemovedSignal = -1;
+
 Query::Query(const QString& type, const QString& domain)
 {
 	d = new QueryPrivate(type,domain);
-	connect(&d->timeout,SIGNAL(timeout()),this,SLOT(timeout()));
+	if (serviceAddedSignal<0) {
+		serviceAddedSignal = staticMetaObject()->findSignal("serviceAdded(DNSSD::RemoteService::Ptr)", true);
+		serviceRemovedSignal = staticMetaObject()->findSignal("serviceRemoved(DNSSD::RemoteService::Ptr)", true);
+	}
 }
 
 
 Query::~Query()
 {
-	if (d->m_browser) {
-	    switch (d->m_browserType) {
-		case Services: avahi_service_browser_free((AvahiServiceBrowser*)d->m_browser); break;
-		case Types: avahi_service_type_browser_free((AvahiServiceTypeBrowser*)d->m_browser); break;
-	    }
-	}		    
+	stop();
 	delete d;
 }
 
+void Query::stop()
+{
+	for (SharedBrowser* b = d->m_browsers.first(); b; b = d->m_browsers.next()) {
+		b->unsubscribe(this);
+		b->release();
+	}
+	d->m_browsers.clear();
+	d->m_running = false;
+	// whatever is still there will be seen again after restart
+	for (QueryPrivate::Instance* inst = d->m_instances.first(); inst; inst = d->m_instances.next(inst))
+		inst->m_sightings.erase(inst->m_sightings.begin(), inst->m_sightings.end());
+	d->m_resync = !d->m_instances.isEmpty();
+}
+
+void Query::reportVanished()
+{
+	d->m_resync = false;
+	QValueList<ServiceRecord> gone;
+	QueryPrivate::Instance* next;
+	for (QueryPrivate::Instance* inst = d->m_instances.first(); inst; inst = next) {
+		next = d->m_instances.next(inst);
+		if (!inst->m_sightings.isEmpty()) continue;
+		gone.append(inst->m_record);
+		d->m_instances.remove(inst);
+	}
+	QValueList<ServiceRecord>::ConstIterator goneEnd = gone.end();
+	for (QValueList<ServiceRecord>::ConstIterator rec = gone.begin(); rec!=goneEnd; ++rec) {
+		const ServiceRecord& record = *rec;
+		emit recordRemoved(record);
+		if (receivers(serviceRemovedSignal))
+			emit serviceRemoved(record.remoteService());
+	}
+}
+
 bool Query::isRunning() const
 {
 	return d->m_running;
@@ -95,91 +156,155 @@ bool Query::isFinished() const
 	return d->m_finished;
 }
 
+bool Query::isCacheExhausted() const
+{
+	return d->m_cacheExhausted;
+}
+
 const QString& Query::domain() const
 {
 	return d->m_domain;
 }
 
-void Query::startQuery()
+const QString& Query::type() const
 {
-	if (d->m_running) return;
-	d->m_finished = false;
-	if (d->m_type=="_services._dns-sd._udp") {
-	    d->m_browserType = Types;
-#ifdef AVAHI_API_0_6
-	    d->m_browser = avahi_service_type_browser_new(Responder::self().client(), AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
-		domainToDNS(d->m_domain), (AvahiLookupFlags)0, types_callback, this);
-#else
-	    d->m_browser = avahi_service_type_browser_new(Responder::self().client(), AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
-		d->m_domain.utf8(), types_callback, this);
-#endif
-	} else {
-	    d->m_browserType = Services;
-#ifdef AVAHI_API_0_6
-	    d->m_browser = avahi_service_browser_new(Responder::self().client(), AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
-	    d->m_type.ascii(),domainToDNS(d->m_domain),  (AvahiLookupFlags)0, services_callback,this);
-#else
-	    d->m_browser = avahi_service_browser_new(Responder::self().client(), AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
-	    d->m_type.ascii(),d->m_domain.utf8(),services_callback,this);
-#endif
-	}
-	if (d->m_browser) {
-		d->m_running=true;
-		d->timeout.start(TIMEOUT_LAN,true);
-	} else emit finished();
+	return d->m_type;
 }
-void Query::virtual_hook(int, void*)
+
+void Query::setInterfaces(const QValueList<int>& interfaces)
 {
+	if (!d->m_running) d->m_interfaces = interfaces;
 }
 
-void Query::customEvent(QCustomEvent* event)
+void Query::setProtocol(RemoteService::Protocol protocol)
 {
-	if (event->type()==QEvent::User+SD_ADDREMOVE) {
-		d->timeout.start(TIMEOUT_LAN,true);
-		d->m_finished=false;
-		AddRemoveEvent *aev = static_cast<AddRemoveEvent*>(event);
-		// m_type has useless trailing dot
-		RemoteService*  svr = new RemoteService(aev->m_name,
-		    	aev->m_type,aev->m_domain);
-		if (aev->m_op==AddRemoveEvent::Add) emit serviceAdded(svr);
-			else emit serviceRemoved(svr);
-	}
+	if (!d->m_running) d->m_protocol = protocol;
 }
 
-void Query::timeout()
+void Query::setCacheOnly(bool cacheOnly)
 {
-	d->m_finished=true;
-	emit finished();
+	if (!d->m_running) d->m_cacheOnly = cacheOnly;
 }
 
-#ifdef AVAHI_API_0_6
-void services_callback (AvahiServiceBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent event, 
-    const char* serviceName, const char* regtype, const char* replyDomain, AvahiLookupResultFlags, void* context)
-#else
-void services_callback (AvahiServiceBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent event, 
-    const char* serviceName, const char* regtype, const char* replyDomain, void* context)
-#endif
+void Query::startQuery()
+{
+	if (d->m_running) return;
+	d->m_finished = false;
+	d->m_cacheExhausted = false;
+	d->m_started = timestamp();
+	d->m_gotResult = false;
+	d->m_unfinished.clear();
+	d->m_uncached.clear();
+	QValueList<int> interfaces = d->m_interfaces;
+	if (interfaces.isEmpty()) interfaces.append(AVAHI_IF_UNSPEC);
+	QValueList<int>::ConstIterator itEnd = interfaces.end();
+	for (QValueList<int>::ConstIterator it = interfaces.begin(); it!=itEnd; ++it) {
+		SharedBrowser* b = SharedBrowser::acquire(d->m_type, d->m_domain, *it,
+			avahiProtocol(d->m_protocol));
+		if (!b) continue;
+		d->m_browsers.append(b);
+		d->m_unfinished.append(*it);
+		d->m_uncached.append(*it);
+	}
+	if (!d->m_browsers.isEmpty()) {
+		d->m_running=true;
+		// subscribe from event loop, so everything already known is reported asynchronously
+		QApplication::postEvent(this, new ServiceEvent(ServiceEvent::Replay));
+	} else emit finished();
+}
+void Query::virtual_hook(int, void*)
 {
-	QObject *obj = reinterpret_cast<QObject*>(context);
-	AddRemoveEvent* arev = new AddRemoveEvent((event==AVAHI_BROWSER_NEW) ? AddRemoveEvent::Add :
-			AddRemoveEvent::Remove, QString::fromUtf8(serviceName), regtype, 
-			DNSToDomain(replyDomain));
-		QApplication::postEvent(obj, arev);
 }
 
-#ifdef AVAHI_API_0_6
-void types_callback(AvahiServiceTypeBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent event, const char* regtype,
-    const char* replyDomain, AvahiLookupResultFlags, void* context)
-#else
-void types_callback(AvahiServiceTypeBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent event, const char* regtype,
-    const char* replyDomain, void* context)
-#endif
+void Query::customEvent(QCustomEvent* event)
 {
-	QObject *obj = reinterpret_cast<QObject*>(context);
-	AddRemoveEvent* arev = new AddRemoveEvent((event==AVAHI_BROWSER_NEW) ? AddRemoveEvent::Add :
-			AddRemoveEvent::Remove, QString::null, regtype, 
-			DNSToDomain(replyDomain));
-		QApplication::postEvent(obj, arev);
+	if (event->type()!=QEvent::User+SD_SERVICE) return;
+	// cache-only query may be stopped in the middle of replay
+	if (!d->m_running) return;
+	ServiceEvent* ev = static_cast<ServiceEvent*>(event);
+	switch (ev->m_op) {
+	case ServiceEvent::Replay: {
+		// iterator survives stop()
+		QPtrListIterator<SharedBrowser> it(d->m_browsers);
+		for ( ; it.current(); ++it) it.current()->subscribe(this);
+		break;
+	}
+	case ServiceEvent::Add: {
+		// only first sighting is reported, also when it was reported before restart
+		uint hash = hashKey(instanceKey(ev));
+		QueryPrivate::Instance* inst = d->m_instances.find(hash, instanceKey(ev));
+		if (inst) {
+			if (qFind(inst->m_sightings.begin(), inst->m_sightings.end(), sighting(ev))==
+				inst->m_sightings.end()) inst->m_sightings.push_back(sighting(ev));
+			break;
+		}
+		ServiceRecord record(ev->m_name, ev->m_type, ev->m_domain, ev->m_interface,
+			fromAvahiProtocol(ev->m_protocol), ev->m_cached);
+		// records are reused, so steady churn does not allocate
+		inst = d->m_instances.alloc();
+		inst->m_sightings.erase(inst->m_sightings.begin(), inst->m_sightings.end());
+		inst->m_sightings.push_back(sighting(ev));
+		inst->m_record = record;
+		d->m_instances.insert(inst, hash);
+		if (!d->m_gotResult) {
+			d->m_gotResult = true;
+			recordLatency(Statistics::FirstResult, d->m_started);
+		}
+		emit recordAdded(record);
+		// do not create RemoteService if nobody wants it
+		if (receivers(serviceAddedSignal))
+			emit serviceAdded(record.remoteService());
+		break;
+	}
+	case ServiceEvent::Remove: {
+		// instance is gone only when it is not seen anywhere
+		QueryPrivate::Instance* inst = d->m_instances.find(hashKey(instanceKey(ev)),
+			instanceKey(ev));
+		if (!inst) break;
+		QValueVector<int>::iterator s = qFind(inst->m_sightings.begin(),
+			inst->m_sightings.end(), sighting(ev));
+		if (s!=inst->m_sightings.end()) inst->m_sightings.erase(s);
+		if (!inst->m_sightings.isEmpty()) break;
+		// the same record as was added, last sighting may be on other interface
+		ServiceRecord record = inst->m_record;
+		d->m_instances.remove(inst);
+		emit recordRemoved(record);
+		if (receivers(serviceRemovedSignal))
+			emit serviceRemoved(record.remoteService());
+		break;
+	}
+	case ServiceEvent::CacheExhausted:
+		d->m_uncached.remove(ev->m_interface);
+		if (!d->m_uncached.isEmpty() || d->m_cacheExhausted) break;
+		d->m_cacheExhausted = true;
+		// cache is all that cache-only query gets
+		if (d->m_cacheOnly && d->m_resync) reportVanished();
+		emit cacheExhausted();
+		if (!d->m_cacheOnly) break;
+		stop();
+		d->m_started = 0;
+		d->m_finished = true;
+		emit finished();
+		break;
+	case ServiceEvent::Failed: {
+		QGuardedPtr<Query> guard(this);
+		emit failed();
+		// failed browser will not report anything more, so it does not hold finished() back
+		if (!guard || !d->m_running) break;
+	}
+	// fall through
+	case ServiceEvent::Finished:
+		// wait until browsers on all interfaces are done
+		d->m_unfinished.remove(ev->m_interface);
+		if (!d->m_unfinished.isEmpty()) break;
+		if (d->m_resync) reportVanished();
+		if (d->m_started) recordLatency(Statistics::QueryFinished, d->m_started);
+		// only first finish after start is measured
+		d->m_started = 0;
+		d->m_finished = true;
+		emit finished();
+		break;
+	}
 }
 
 }
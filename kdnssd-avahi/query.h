@@ -22,7 +22,9 @@
 #define DNSSDQUERY_H
 
 #include <qobject.h>
+#include <qvaluelist.h>
 #include <dnssd/remoteservice.h>
+#include <dnssd/servicerecord.h>
 
 
 namespace DNSSD
@@ -31,7 +33,8 @@ class QueryPrivate;
 
 /**
 This class provides way to search for specified service type in one domain. Depending on domain
-name, either multicast or unicast DNS will be used.
+name, either multicast or unicast DNS will be used. Queries for the same type and domain share one avahi
+browser.
  
 @short Class that represents service query in one domain.
 @author Jakub Stachowski
@@ -43,7 +46,8 @@ public:
 	/**
 	Creates new query. 
 
-	@param type Type of services to browse for
+	@param type Type of services to browse for. It can be subtype returned by
+			ServiceBase::subtypeName(), found services are then reported with parent type
 	@param domain Domain name - if set to "local." multicast query will be performed,
 			otherwise unicast
 	 */
@@ -52,7 +56,29 @@ public:
 	virtual ~Query();
 
 	/**
-	Starts query. Ignored if query is already running
+	Restricts query to given network interfaces. Empty list (default) means all. Has to
+	be called before startQuery().
+	@param interfaces Interface indexes as returned by if_nametoindex()
+	 */
+	void setInterfaces(const QValueList<int>& interfaces);
+
+	/**
+	Restricts query to given IP protocol. Default is RemoteService::AnyProtocol. Has to be
+	called before startQuery().
+	 */
+	void setProtocol(RemoteService::Protocol protocol);
+
+	/**
+	Makes query report only services that daemon already has in its cache. Query stops
+	as soon as cache is exhausted, emitting cacheExhausted() and finished(), and later
+	changes are not reported. Has to be called before startQuery().
+	 */
+	void setCacheOnly(bool cacheOnly);
+
+	/**
+	Starts query. Ignored if query is already running. Query stopped after its cache
+	was exhausted can be started again: instances reported before are not reported again
+	and those that disappeared meanwhile are reported as removed when it finishes.
 	 */
 	virtual void startQuery();
 
@@ -68,34 +94,75 @@ public:
 	 */
 	bool isFinished() const;
 
+	/**
+	Returns TRUE if all services from daemon's cache has been reported
+	 */
+	bool isCacheExhausted() const;
+
 	/**
 	Returns queried domain
 	 */
 	const QString& domain() const;
 
+	/**
+	Returns queried type as passed to constructor
+	 */
+	const QString& type() const;
+
 signals:
 	/**
-	Emitted when new service has been discovered
+	Emitted when new service has been discovered. Interface and protocol it was first
+	found with are set in RemoteService.
 	 */
 	void serviceAdded(DNSSD::RemoteService::Ptr);
 
 	/**
-	Emitted when previously discovered service is not longer published
+	Emitted when previously discovered service is not longer published. Service seen on more
+	interfaces or with both IPv4 and IPv6 is reported once, when it is seen first, and
+	removed when it is not seen anywhere.
 	 */
 	void serviceRemoved(DNSSD::RemoteService::Ptr);
 
 	/**
-	Emitted when all announced services has been reported. 
+	Same as serviceAdded(), but service is described by lightweight record. If only
+	this signal is connected, no RemoteService objects are created.
+	 */
+	void recordAdded(const DNSSD::ServiceRecord&);
+
+	/**
+	Same as serviceRemoved(), but service is described by lightweight record.
+	 */
+	void recordRemoved(const DNSSD::ServiceRecord&);
+
+	/**
+	Emitted once, when all services daemon had in its cache has been reported. It
+	usually comes within milliseconds, long before finished(), so it can be used to
+	fill user interface and then keep updating it.
+	 */
+	void cacheExhausted();
+
+	/**
+	Emitted when all announced services has been reported. First time it happens when
+	daemon says so or, for unicast domains, when it does not do it in time. After that it
+	concludes every batch of changes.
 	 */
 	void finished();
 
+	/**
+	Emitted when browsing failed, for example because DNS server could not be contacted.
+	It is followed by finished().
+	 */
+	void failed();
+
 protected:
 	virtual void virtual_hook(int, void*);
 	virtual void customEvent(QCustomEvent* event);
 private:
 	QueryPrivate *d;
-private slots:
-	void timeout();
+
+	void stop();
+	// reports instances not seen since restart as removed
+	void reportVanished();
 };
 
 }
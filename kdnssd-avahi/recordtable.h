@@ -0,0 +1,193 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DNSSDRECORDTABLE_H
+#define DNSSDRECORDTABLE_H
+
+#include <qmemarray.h>
+#include <qstring.h>
+
+namespace DNSSD
+{
+
+/**
+Hash table owning records that are chained through their own m_next member, so
+inserting does not allocate bucket nodes the way QDict does. Removed records go to a
+free list and are handed out again by alloc(), which keeps whatever buffers they own.
+Once the table reached its working size, adding and removing does not touch the heap.
+
+Record type has to have members T* m_next and uint m_hash, and method
+bool matches(const Key&) const for every key type used with find().
+
+@short Internal hash table of pooled records
+ */
+template<class T> class RecordTable
+{
+public:
+	/**
+	@param size Initial number of buckets, it is doubled when table gets fuller
+	@param spare Maximum number of removed records kept for reuse
+	 */
+	RecordTable(uint size=127, uint spare=256) : m_buckets(size), m_count(0), m_free(0),
+		m_spareCount(0), m_spareLimit(spare)
+	{
+		m_buckets.fill(0);
+	}
+	~RecordTable()
+	{
+		clear();
+		while (m_free) {
+			T* next = m_free->m_next;
+			delete m_free;
+			m_free = next;
+		}
+	}
+
+	uint count() const { return m_count; }
+	bool isEmpty() const { return !m_count; }
+
+	template<class Key> T* find(uint hash, const Key& key) const
+	{
+		for (T* r = m_buckets[hash%m_buckets.size()]; r; r = r->m_next)
+			if (r->m_hash==hash && r->matches(key)) return r;
+		return 0;
+	}
+
+	/**
+	Returns unused record, it has to be filled and passed to insert()
+	 */
+	T* alloc()
+	{
+		if (!m_free) return new T;
+		T* r = m_free;
+		m_free = r->m_next;
+		m_spareCount--;
+		return r;
+	}
+
+	void insert(T* record, uint hash)
+	{
+		if (m_count>=m_buckets.size()) grow();
+		record->m_hash = hash;
+		T*& head = m_buckets[hash%m_buckets.size()];
+		record->m_next = head;
+		head = record;
+		m_count++;
+	}
+
+	/**
+	Takes record out of the table and keeps it for reuse. Record must not be used after that
+	 */
+	void remove(T* record)
+	{
+		for (T** r = &m_buckets[record->m_hash%m_buckets.size()]; *r; r = &(*r)->m_next)
+			if (*r==record) {
+				*r = record->m_next;
+				m_count--;
+				release(record);
+				return;
+			}
+	}
+
+	void clear()
+	{
+		uint size = m_buckets.size();
+		for (uint i=0; i<size; i++) {
+			T* r = m_buckets[i];
+			m_buckets[i] = 0;
+			while (r) {
+				T* next = r->m_next;
+				release(r);
+				r = next;
+			}
+		}
+		m_count = 0;
+	}
+
+	/**
+	Iteration, next() of record has to be taken before removing it
+	 */
+	T* first() const { return scan(0); }
+	T* next(const T* record) const
+	{
+		return (record->m_next) ? record->m_next : scan(record->m_hash%m_buckets.size()+1);
+	}
+
+private:
+	T* scan(uint bucket) const
+	{
+		uint size = m_buckets.size();
+		for ( ; bucket<size; bucket++) if (m_buckets[bucket]) return m_buckets[bucket];
+		return 0;
+	}
+	void release(T* record)
+	{
+		if (m_spareCount>=m_spareLimit) {
+			delete record;
+			return;
+		}
+		record->m_next = m_free;
+		m_free = record;
+		m_spareCount++;
+	}
+	void grow()
+	{
+		// arrays are explicitly shared, old one stays with the copy
+		QMemArray<T*> old = m_buckets;
+		uint size = old.size()*2+1;
+		m_buckets = QMemArray<T*>(size);
+		m_buckets.fill(0);
+		for (uint i=0; i<old.size(); i++) {
+			T* r = old[i];
+			while (r) {
+				T* next = r->m_next;
+				T*& head = m_buckets[r->m_hash%size];
+				r->m_next = head;
+				head = r;
+				r = next;
+			}
+		}
+	}
+
+	QMemArray<T*> m_buckets;
+	uint m_count;
+	// removed records kept for reuse, chained through m_next
+	T* m_free;
+	uint m_spareCount;
+	uint m_spareLimit;
+};
+
+// FNV-1a hashes for keys of RecordTable
+inline uint hashKey(const char* key)
+{
+	uint h = 2166136261u;
+	for ( ; *key; key++) h = (h^(unsigned char)*key)*16777619u;
+	return h;
+}
+
+inline uint hashKey(const QString& key)
+{
+	uint h = 2166136261u;
+	const QChar* c = key.unicode();
+	for (uint i=key.length(); i; i--, c++) h = (h^c->unicode())*16777619u;
+	return h;
+}
+
+}
+
+#endif
@@ -22,6 +22,7 @@
 
 #include <qeventloop.h>
 #include <qapplication.h>
+#include <qdatetime.h>
 #include <kurl.h>
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
@@ -29,12 +30,14 @@
 #include <netinet/in.h>
 #include <avahi-client/client.h>
 #include <avahi-common/strlst.h>
+#include <avahi-common/malloc.h>
 #ifdef AVAHI_API_0_6
 #include <avahi-client/lookup.h>
 #endif
 #include "remoteservice.h"
 #include "responder.h"
 #include "sdevent.h"
+#include "serviceregistry.h"
 
 namespace DNSSD
 {
@@ -48,34 +51,117 @@ void resolve_callback(AvahiServiceResolver*, AvahiIfIndex, AvahiProtocol proto,
     uint16_t port, AvahiStringList* txt, void* context);
 #endif
 
-class RemoteServicePrivate : public Responder
+class RemoteServicePrivate : public ClientObject
 {
 public:
-	RemoteServicePrivate() :  m_resolved(false), m_running(false), m_resolver(0) {}
+	RemoteServicePrivate(RemoteService* owner) : ClientObject(ResolverObject), m_resolved(false),
+		m_running(false), m_resolver(0), m_responder(0), m_owner(owner), m_result(NoResult),
+		m_resultHost(0), m_resultPort(0), m_resultTxt(0), m_started(0),
+		m_interface(AVAHI_IF_UNSPEC), m_protocol(RemoteService::AnyProtocol), m_unpinned(false),
+		m_cached(false), m_shared(false) {}
+	~RemoteServicePrivate() { clearResult(); }
 	bool m_resolved;
 	bool m_running;
 	AvahiServiceResolver* m_resolver;
+	Responder* m_responder;
+	RemoteService* m_owner;
+	// name, type and domain prepared for avahi
+	QCString m_dnsName;
+	QCString m_dnsType;
+	QCString m_dnsDomain;
+
+	// result left by resolve_callback in threaded mode. Guarded by client lock
+	enum Result { NoResult, Found, Failed };
+	Result m_result;
+	char* m_resultHost;
+	unsigned short m_resultPort;
+	AvahiStringList* m_resultTxt;
+	// timestamp of resolveAsync()
+	uint m_started;
+	// where service was found
+	int m_interface;
+	RemoteService::Protocol m_protocol;
+	// resolve on that interface and protocol failed, so any one is used from now on
+	bool m_unpinned;
+	bool isPinned() const { return !m_unpinned && (m_interface!=AVAHI_IF_UNSPEC ||
+		m_protocol!=RemoteService::AnyProtocol); }
+	bool m_cached;
+	// registered in ServiceRegistry
+	bool m_shared;
+
+	void clearResult() {
+	    m_result = NoResult;
+	    delete[] m_resultHost;
+	    m_resultHost = 0;
+	    if (m_resultTxt) avahi_string_list_free(m_resultTxt);
+	    m_resultTxt = 0;
+	}
 	void stop() {
+	    if (m_running) m_responder->detach(this);
 	    m_running = false;
-	    if (m_resolver) avahi_service_resolver_free(m_resolver);
-	    m_resolver=0;
 	}
+	virtual bool create(AvahiClient* client);
+	virtual void destroy();
+	virtual void createFailed();
 };
 
+bool RemoteServicePrivate::create(AvahiClient* client)
+{
+	AvahiIfIndex interface = (m_unpinned) ? AVAHI_IF_UNSPEC : m_interface;
+	AvahiProtocol protocol = (m_unpinned) ? AVAHI_PROTO_UNSPEC : avahiProtocol(m_protocol);
+#ifdef AVAHI_API_0_6
+	m_resolver = avahi_service_resolver_new(client, interface, protocol,
+	    m_dnsName, m_dnsType, m_dnsDomain, AVAHI_PROTO_UNSPEC, AVAHI_LOOKUP_NO_ADDRESS,
+	    resolve_callback, this);
+#else
+	m_resolver = avahi_service_resolver_new(client, interface, protocol,
+	    m_dnsName, m_dnsType, m_dnsDomain, AVAHI_PROTO_UNSPEC, resolve_callback, this);
+#endif
+	if (m_resolver) countObject(Statistics::Resolvers,1);
+	return m_resolver!=0;
+}
+
+void RemoteServicePrivate::createFailed()
+{
+	// nobody is waiting for return value, report failure as if resolver did
+	clearResult();
+	m_result = Failed;
+	QApplication::postEvent(m_owner, new ResolveEvent(0,0,0));
+}
+
+void RemoteServicePrivate::destroy()
+{
+	if (m_resolver) {
+		avahi_service_resolver_free(m_resolver);
+		countObject(Statistics::Resolvers,-1);
+	}
+	m_resolver = 0;
+	clearResult();
+}
+
 RemoteService::RemoteService(const QString& label)
 {
 	decode(label);
-	d =  new RemoteServicePrivate();
+	d =  new RemoteServicePrivate(this);
 }
 RemoteService::RemoteService(const QString& name,const QString& type,const QString& domain)
 		: ServiceBase(name, type, domain)
 {
-	d = new RemoteServicePrivate();
+	d = new RemoteServicePrivate(this);
+}
+
+RemoteService::RemoteService(const QString& name,const QString& type,const QString& domain,
+	int interfaceIndex, Protocol protocol, bool cached) : ServiceBase(name, type, domain)
+{
+	d = new RemoteServicePrivate(this);
+	d->m_interface = interfaceIndex;
+	d->m_protocol = protocol;
+	d->m_cached = cached;
 }
 
 RemoteService::RemoteService(const KURL& url)
 {
-	d = new RemoteServicePrivate();
+	d = new RemoteServicePrivate(this);
 	if (!url.isValid()) return;
 	if (url.protocol()!="invitation") return;
 	if (!url.hasPath()) return;
@@ -89,32 +175,97 @@ RemoteService::RemoteService(const KURL& url)
 
 RemoteService::~RemoteService()
 {
-	if (d->m_resolver) avahi_service_resolver_free(d->m_resolver);
+	if (d->m_shared) ServiceRegistry::self().remove(this);
+	d->stop();
 	delete d;
 }
 
+RemoteService::Ptr RemoteService::shared(const QString& name,const QString& type,
+	const QString& domain, int interfaceIndex, Protocol protocol, bool cached)
+{
+	RemoteService* svr = ServiceRegistry::self().find(name,type,domain,interfaceIndex,protocol);
+	if (svr) {
+		// somebody has seen it announced, so it is not just an old cache entry
+		if (!cached) svr->d->m_cached = false;
+		return svr;
+	}
+	svr = new RemoteService(name, type, domain, interfaceIndex, protocol, cached);
+	svr->d->m_shared = true;
+	ServiceRegistry::self().insert(svr);
+	return svr;
+}
+
+void RemoteService::setResolveCacheTTL(int ttl)
+{
+	ServiceRegistry::self().setTTL(ttl);
+}
+
 bool RemoteService::resolve()
 {
+	return resolve(-1)==ResolveSuccess;
+}
+
+RemoteService::ResolveResult RemoteService::resolve(int timeout)
+{
+	QTime time;
+	time.start();
 	resolveAsync();
-	while (d->m_running && !d->m_resolved) Responder::self().process();
+	bool timedOut = false;
+	while (d->m_running && !d->m_resolved && !d->m_responder->failed()) {
+		int left = timeout-time.elapsed();
+		if (timeout>=0 && left<=0) {
+			timedOut = true;
+			break;
+		}
+		Responder::self().process((timeout>=0) ? left : -1);
+	}
+	// resolver that failed has already reported it
+	bool unanswered = d->m_running && !d->m_resolved;
 	d->stop();
-	return d->m_resolved;
+	if (d->m_resolved) return ResolveSuccess;
+	if (unanswered) emit resolved(false);
+	return (timedOut) ? ResolveTimeout : ResolveFailure;
 }
 
 void RemoteService::resolveAsync()
 {
-	if (d->m_running) return;
+	// resolve waiting for first answer is joined, resolver watching for changes already
+	// has current data
+	if (d->m_running) {
+		if (d->m_resolved) emit resolved(true);
+		return;
+	}
+	if (ServiceRegistry::self().lookup(this, m_hostName, m_port, m_textData)) {
+		d->m_resolved = true;
+		emit resolved(true);
+		return;
+	}
+	startResolver();
+}
+
+void RemoteService::resolveUncached()
+{
+	if (d->m_running) {
+		if (!d->m_resolved) return;
+		d->stop();
+	}
+	startResolver();
+}
+
+void RemoteService::startResolver()
+{
 	d->m_resolved = false;
+	d->m_started = timestamp();
 	// FIXME: first protocol should be set?
+	d->m_dnsName = m_serviceName.utf8();
+	d->m_dnsType = m_type.ascii();
 #ifdef AVAHI_API_0_6
-	d->m_resolver = avahi_service_resolver_new(Responder::self().client(),AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
-	    m_serviceName.utf8(), m_type.ascii(), domainToDNS(m_domain), AVAHI_PROTO_UNSPEC, AVAHI_LOOKUP_NO_ADDRESS,
-	    resolve_callback, this);
+	d->m_dnsDomain = domainToDNS(m_domain);
 #else
-	d->m_resolver = avahi_service_resolver_new(Responder::self().client(),AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
-	    m_serviceName.utf8(), m_type.ascii(), m_domain.utf8(), AVAHI_PROTO_UNSPEC, resolve_callback, this);
+	d->m_dnsDomain = m_domain.utf8();
 #endif
-	if (d->m_resolver) d->m_running=true;
+	d->m_responder = &Responder::pick(ResolverObject);
+	if (d->m_responder->attach(d)) d->m_running=true;
 	    else  emit resolved(false);
 }
 
@@ -123,19 +274,84 @@ bool RemoteService::isResolved() const
 	return d->m_resolved;
 }
 
+int RemoteService::interfaceIndex() const
+{
+	return d->m_interface;
+}
+
+RemoteService::Protocol RemoteService::protocol() const
+{
+	return d->m_protocol;
+}
+
+bool RemoteService::isCached() const
+{
+	return d->m_cached;
+}
+
 void RemoteService::customEvent(QCustomEvent* event)
 {
+	if (event->type() == QEvent::User+SD_RESOLVE && !static_cast<ResolveEvent*>(event)->m_hostname) {
+		// posted from avahi thread, take result left by resolve_callback
+		d->m_responder->lock();
+		RemoteServicePrivate::Result result = d->m_result;
+		char* host = d->m_resultHost;
+		unsigned short port = d->m_resultPort;
+		AvahiStringList* txt = d->m_resultTxt;
+		d->m_result = RemoteServicePrivate::NoResult;
+		d->m_resultHost = 0;
+		d->m_resultTxt = 0;
+		d->m_responder->unlock();
+		if (result == RemoteServicePrivate::Failed) {
+			ErrorEvent err;
+			customEvent(&err);
+		}
+		if (result == RemoteServicePrivate::Found) {
+			ResolveEvent rev(host,port,txt);
+			customEvent(&rev);
+		}
+		delete[] host;
+		if (txt) avahi_string_list_free(txt);
+		return;
+	}
 	if (event->type() == QEvent::User+SD_ERROR) {
 		d->stop();
+		// interface service was first seen on may be gone while it is still seen on others
+		if (d->isPinned() && !d->m_responder->failed()) {
+			d->m_unpinned = true;
+			d->m_responder = &Responder::pick(ResolverObject);
+			if (d->m_responder->attach(d)) {
+				d->m_running = true;
+				return;
+			}
+		}
 		d->m_resolved=false;
+		ServiceRegistry::self().drop(this);
+		// only first answer after resolveAsync() is measured
+		if (d->m_started) recordLatency(Statistics::Resolve, d->m_started);
+		d->m_started = 0;
 		emit resolved(false);
 	}
 	if (event->type() == QEvent::User+SD_RESOLVE) {
 		ResolveEvent* rev = static_cast<ResolveEvent*>(event);
-		m_hostName = rev->m_hostname;
+		m_hostName = DNSToDomain(rev->m_hostname);
 		m_port = rev->m_port;
-		m_textData = rev->m_txtdata;
+		m_textData.clear();
+		AvahiStringList* txt = rev->m_txt;
+		while (txt) {
+		    char *key, *value;
+		    size_t size;
+		    if (avahi_string_list_get_pair(txt,&key,&value,&size)) break;
+		    m_textData[QString::fromUtf8(key)]=(value) ? QString::fromUtf8(value) : QString::null;
+		    avahi_free(key);
+		    avahi_free(value);
+		    txt = txt->next;
+		}
 		d->m_resolved = true;
+		ServiceRegistry::self().store(this);
+		if (d->m_started) recordLatency(Statistics::Resolve, d->m_started);
+		// later updates from watching resolver are not measured
+		d->m_started = 0;
 		emit resolved(true);
 	}
 }
@@ -157,10 +373,19 @@ QDataStream & operator>> (QDataStream & s, RemoteService & a)
 {
 	// stop any possible resolve going on
 	a.d->stop();
+	// shared service is registered under its old name, type and domain
+	ServiceRegistry& registry = ServiceRegistry::self();
+	if (a.d->m_shared) registry.remove(&a);
 	Q_INT8 resolved;
 	operator>>(s,(static_cast<ServiceBase&>(a)));
 	s >> resolved;
 	a.d->m_resolved = (resolved == 1);	
+	if (a.d->m_shared) {
+		// the new service may already have its own shared object
+		if (registry.find(a.serviceName(), a.type(), a.domain(), a.interfaceIndex(), a.protocol()))
+			a.d->m_shared = false;
+		else registry.insert(&a);
+	}
 	return s;
 }
 
@@ -174,22 +399,30 @@ void resolve_callback(AvahiServiceResolver*, AvahiIfIndex, AvahiProtocol, AvahiR
     uint16_t port, AvahiStringList* txt, void* context)
 #endif
 {
-	QObject *obj = reinterpret_cast<QObject*>(context);
+	countCallback();
+	RemoteServicePrivate *d = reinterpret_cast<RemoteServicePrivate*>(context);
+	if (d->m_responder->isThreaded()) {
+		// avahi thread with client locked - leave result for GUI thread
+		d->clearResult();
+		d->m_result = (e == AVAHI_RESOLVER_FOUND) ? RemoteServicePrivate::Found : RemoteServicePrivate::Failed;
+		if (e == AVAHI_RESOLVER_FOUND) {
+			d->m_resultHost = qstrdup(hostname);
+			d->m_resultPort = port;
+			d->m_resultTxt = avahi_string_list_copy(txt);
+		}
+		QApplication::postEvent(d->m_owner, new ResolveEvent(0,0,0));
+		countEvent();
+		return;
+	}
 	if (e != AVAHI_RESOLVER_FOUND) {
 		ErrorEvent err;
-		QApplication::sendEvent(obj, &err);	
+		countEvent();
+		QApplication::sendEvent(d->m_owner, &err);	
 		return;
 	}
-	QMap<QString,QString> map;
-	while (txt) {
-	    char *key, *value;
-	    size_t size;
-	    if (avahi_string_list_get_pair(txt,&key,&value,&size)) break;
-	    map[QString::fromUtf8(key)]=(value) ? QString::fromUtf8(value) : QString::null;
-	    txt = txt->next;
-	}
-	ResolveEvent rev(DNSToDomain(hostname),port,map);
-	QApplication::sendEvent(obj, &rev);
+	ResolveEvent rev(hostname,port,txt);
+	countEvent();
+	QApplication::sendEvent(d->m_owner, &rev);
 }
 
 
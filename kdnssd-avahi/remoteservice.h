@@ -44,6 +44,14 @@ class KDNSSD_EXPORT RemoteService : public QObject, public ServiceBase
 	Q_OBJECT
 public:
 	typedef KSharedPtr<RemoteService> Ptr;
+
+	/**
+	IP protocol over which service is browsed or was found
+	@li AnyProtocol - both IPv4 and IPv6
+	@li IPv4 - IPv4 only
+	@li IPv6 - IPv6 only
+	 */
+	enum Protocol { AnyProtocol, IPv4, IPv6 };
 	
 	/**
 	Creates unresolved service from given DNS label
@@ -56,6 +64,15 @@ public:
 	Creates unresolved remote service with given name, type and domain.
 	 */
 	RemoteService(const QString& name,const QString& type,const QString& domain);
+
+	/**
+	Creates unresolved remote service found on given network interface using given protocol.
+	It is resolved only there.
+	@param interfaceIndex Index of network interface as returned by if_nametoindex(), -1 means any
+	@param cached Service was reported from daemon's cache, see isCached()
+	 */
+	RemoteService(const QString& name,const QString& type,const QString& domain,
+		int interfaceIndex, Protocol protocol, bool cached=false);
 	
 	/**
 	Creates resolved remote service from invitation URL constructed by PublicService::toInvitation.
@@ -64,25 +81,77 @@ public:
 	RemoteService(const KURL& url);
 	
 	virtual ~RemoteService();
+
+	/**
+	Returns service object shared by whole process for given name, type, domain, network
+	interface and protocol. It is created if it does not exist yet. Existing service stops
+	being cached (see isCached()) when it is requested with @p cached set to false.
+	Everybody who gets shared service also gets results of its resolves, so instance
+	seen by several browsers is resolved only once.
+	 */
+	static Ptr shared(const QString& name,const QString& type,const QString& domain,
+		int interfaceIndex=-1, Protocol protocol=AnyProtocol, bool cached=false);
+
+	/**
+	Sets how long (in milliseconds) successful resolves are remembered. Service resolved
+	within that time is resolved again immediately, without asking daemon. Default is
+	10 seconds, 0 or less disables it.
+	 */
+	static void setResolveCacheTTL(int ttl);
 	
 	/**
 	Resolves host name and port of service. Host name is not resolved into numeric
 	address - use KResolver for that. Signal resolved(bool) will be emitted 
-	when finished or even before return of this function - in case of immediate failure.
+	when finished or even before return of this function - in case of immediate failure
+	or when the same instance was resolved recently (see setResolveCacheTTL()). Service
+	resolved from cache is not watched for later changes. Service that is resolved and
+	still watched reports its current data at once.
 	 */
 	void resolveAsync();
 	
+	/**
+	Result of synchronous resolving
+	@li ResolveSuccess - service has been resolved
+	@li ResolveFailure - service could not be resolved
+	@li ResolveTimeout - no answer until deadline
+	 */
+	enum ResolveResult { ResolveSuccess, ResolveFailure, ResolveTimeout };
+
 	/**
 	Synchronous version of resolveAsync(). Note that resolved(bool) is emitted 
 	before this function returns, 
 	@return TRUE is successful
 	 */
 	bool resolve();
+
+	/**
+	Synchronous version of resolveAsync() that gives up after timeout. Application
+	sleeps until the daemon answers, so it does not use CPU while waiting. resolved(bool)
+	is emitted before return also on timeout.
+	@param timeout Maximum time to wait in milliseconds, negative value means no limit
+	 */
+	ResolveResult resolve(int timeout);
 	
 	/**
 	Returns true if service has been successfully resolved
 	 */
 	bool isResolved() const;
+
+	/**
+	Returns index of network interface service was found on, -1 if it is not known
+	 */
+	int interfaceIndex() const;
+
+	/**
+	Returns protocol service was found with
+	 */
+	Protocol protocol() const;
+
+	/**
+	Returns true if service was found in daemon's cache instead of being announced on
+	network after browsing started. Such service may be already gone.
+	 */
+	bool isCached() const;
 	
 signals:
 	/**
@@ -96,6 +165,9 @@ protected:
 	virtual void virtual_hook(int id, void *data);
 	virtual void customEvent(QCustomEvent* event);
 private:
+	// asks daemon again even if service is resolved, used by ResolveScheduler
+	void resolveUncached();
+	void startResolver();
 	void resolveError();
 	void resolved(const char *host, unsigned short port, unsigned short txtlen,
 		const char* txtRecord);
@@ -103,6 +175,7 @@ private:
 
 	friend KDNSSD_EXPORT QDataStream & operator<< (QDataStream & s, const RemoteService & a);
 	friend KDNSSD_EXPORT QDataStream & operator>> (QDataStream & s, RemoteService & a);
+	friend class ResolveScheduler;
 
 };
 
@@ -0,0 +1,290 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <qapplication.h>
+#include <kstaticdeleter.h>
+#include "resolvescheduler.h"
+#include "responder.h"
+#include "sdevent.h"
+
+#define MAX_RESOLVES 10
+#define RESOLVE_TIMEOUT 10000
+
+namespace DNSSD
+{
+
+static KStaticDeleter<ResolveScheduler> scheduler_sd;
+ResolveScheduler* ResolveScheduler::m_self = 0;
+
+ResolveScheduler& ResolveScheduler::self()
+{
+	if (!m_self) scheduler_sd.setObject(m_self, new ResolveScheduler);
+	return *m_self;
+}
+
+ResolveScheduler::ResolveScheduler() : QObject(), m_jobs(1021), m_max(MAX_RESOLVES),
+	m_timeout(RESOLVE_TIMEOUT), m_queued(0), m_scheduling(false)
+{
+	for (int i=0; i<Priorities; i++) m_waiting[i].setAutoDelete(true);
+	m_jobs.setAutoDelete(true);
+	connect(&m_timer,SIGNAL(timeout()),this,SLOT(timedOut()));
+}
+
+ResolveScheduler::~ResolveScheduler()
+{
+}
+
+void ResolveScheduler::enqueue(RemoteService::Ptr service, QObject* owner, Priority priority,
+	bool uncached)
+{
+	QPtrList<OwnerQueue>& waiting = m_waiting[priority];
+	OwnerQueue* queue = 0;
+	for (OwnerQueue* q = waiting.first(); q && !queue; q = waiting.next())
+		if (q->m_owner==owner) queue = q;
+	if (!queue) {
+		queue = new OwnerQueue;
+		queue->m_owner = owner;
+		queue->m_priority = priority;
+		waiting.append(queue);
+	}
+	Job job;
+	job.m_service = service;
+	job.m_owner = owner;
+	job.m_time = timestamp();
+	job.m_uncached = uncached;
+	Waiting w;
+	w.m_queue = queue;
+	w.m_job = queue->m_jobs.append(job);
+	jobsOf(service)->m_waiting.append(w);
+	m_queued++;
+	schedule();
+}
+
+void ResolveScheduler::cancel(RemoteService* service, QObject* owner)
+{
+	ServiceJobs* jobs = m_jobs.find(service);
+	if (!jobs) return;
+	// shared service may be resolved for several owners
+	QValueList<Waiting>::Iterator wEnd = jobs->m_waiting.end();
+	for (QValueList<Waiting>::Iterator w = jobs->m_waiting.begin(); w!=wEnd; ++w) {
+		if ((*w).m_queue->m_owner!=owner) continue;
+		unqueue(jobs, w);
+		releaseJobs(service, jobs);
+		return;
+	}
+	QValueList<QValueList<Job>::Iterator>::Iterator itEnd = jobs->m_running.end();
+	for (QValueList<QValueList<Job>::Iterator>::Iterator it = jobs->m_running.begin(); it!=itEnd; ++it) {
+		if ((**it).m_owner!=owner) continue;
+		retire(*it);
+		restartTimer();
+		schedule();
+		return;
+	}
+}
+
+void ResolveScheduler::cancel(QObject* owner)
+{
+	for (int i=0; i<Priorities; i++) {
+		QPtrList<OwnerQueue>& waiting = m_waiting[i];
+		for (OwnerQueue* q = waiting.first(); q; q = waiting.next()) {
+			if (q->m_owner!=owner) continue;
+			// unqueue() deletes queue with its last job
+			for (uint left = q->m_jobs.count(); left; left--) {
+				RemoteService* service = q->m_jobs.first().m_service;
+				ServiceJobs* jobs = m_jobs.find(service);
+				QValueList<Waiting>::Iterator w = jobs->m_waiting.begin();
+				while ((*w).m_queue!=q) ++w;
+				unqueue(jobs, w);
+				releaseJobs(service, jobs);
+			}
+			break;
+		}
+	}
+	QValueList<Job>::Iterator it = m_running.begin();
+	while (it!=m_running.end()) {
+		if ((*it).m_owner!=owner) ++it;
+			else it = retire(it);
+	}
+	restartTimer();
+	schedule();
+}
+
+void ResolveScheduler::setMaxResolves(uint count)
+{
+	m_max = QMAX(count,1u);
+	schedule();
+}
+
+uint ResolveScheduler::maxResolves() const
+{
+	return m_max;
+}
+
+void ResolveScheduler::setTimeout(int timeout)
+{
+	m_timeout = timeout;
+	restartTimer();
+}
+
+int ResolveScheduler::timeout() const
+{
+	return m_timeout;
+}
+
+uint ResolveScheduler::queued() const
+{
+	return m_queued;
+}
+
+uint ResolveScheduler::running() const
+{
+	return m_running.count();
+}
+
+bool ResolveScheduler::take(Job& job)
+{
+	for (int i=0; i<Priorities; i++) {
+		QPtrList<OwnerQueue>& waiting = m_waiting[i];
+		OwnerQueue* q = waiting.first();
+		if (!q) continue;
+		job = q->m_jobs.first();
+		// entry of service stays, schedule() adds running job to it
+		ServiceJobs* jobs = m_jobs.find(job.m_service);
+		QValueList<Waiting>::Iterator w = jobs->m_waiting.begin();
+		while ((*w).m_job!=q->m_jobs.begin()) ++w;
+		jobs->m_waiting.remove(w);
+		q->m_jobs.remove(q->m_jobs.begin());
+		m_queued--;
+		// this owner goes to the end of line
+		waiting.take();
+		if (q->m_jobs.isEmpty()) delete q;
+			else waiting.append(q);
+		return true;
+	}
+	return false;
+}
+
+void ResolveScheduler::schedule()
+{
+	// resolveAsync() may report failure immediately and get here again
+	if (m_scheduling) return;
+	m_scheduling = true;
+	Job job;
+	while (m_running.count()<m_max && take(job)) {
+		recordLatency(Statistics::ResolveWait, job.m_time);
+		job.m_time = timestamp();
+		// service enqueued by several owners is connected and resolved once
+		bool running = isRunning(job.m_service);
+		jobsOf(job.m_service)->m_running.append(m_running.append(job));
+		if (m_running.count()==1) restartTimer();
+		if (running) continue;
+		connect(job.m_service,SIGNAL(resolved(bool)),this,SLOT(resolved(bool)));
+		if (job.m_uncached) job.m_service->resolveUncached();
+			else job.m_service->resolveAsync();
+	}
+	m_scheduling = false;
+}
+
+void ResolveScheduler::restartTimer()
+{
+	if (m_running.isEmpty() || m_timeout<0) {
+		m_timer.stop();
+		return;
+	}
+	int left = m_timeout-(int)(timestamp()-m_running.first().m_time);
+	m_timer.start(QMAX(left,0),true);
+}
+
+bool ResolveScheduler::isRunning(RemoteService* service) const
+{
+	ServiceJobs* jobs = m_jobs.find(service);
+	return jobs && !jobs->m_running.isEmpty();
+}
+
+ResolveScheduler::ServiceJobs* ResolveScheduler::jobsOf(RemoteService* service)
+{
+	ServiceJobs* jobs = m_jobs.find(service);
+	if (!jobs) {
+		jobs = new ServiceJobs;
+		m_jobs.insert(service, jobs);
+	}
+	return jobs;
+}
+
+void ResolveScheduler::releaseJobs(RemoteService* service, ServiceJobs* jobs)
+{
+	if (jobs->m_waiting.isEmpty() && jobs->m_running.isEmpty()) m_jobs.remove(service);
+}
+
+void ResolveScheduler::unqueue(ServiceJobs* jobs, QValueList<Waiting>::Iterator waiting)
+{
+	OwnerQueue* q = (*waiting).m_queue;
+	q->m_jobs.remove((*waiting).m_job);
+	jobs->m_waiting.remove(waiting);
+	m_queued--;
+	// there are only few owners
+	if (q->m_jobs.isEmpty()) m_waiting[q->m_priority].removeRef(q);
+}
+
+QValueList<ResolveScheduler::Job>::Iterator ResolveScheduler::retire(QValueList<Job>::Iterator job)
+{
+	RemoteService::Ptr service = (*job).m_service;
+	ServiceJobs* jobs = m_jobs.find(service);
+	jobs->m_running.remove(job);
+	bool running = !jobs->m_running.isEmpty();
+	releaseJobs(service, jobs);
+	job = m_running.remove(job);
+	if (!running) disconnect(service,SIGNAL(resolved(bool)),this,SLOT(resolved(bool)));
+	if (m_done.isEmpty()) QTimer::singleShot(0,this,SLOT(releaseDone()));
+	m_done.append(service);
+	return job;
+}
+
+void ResolveScheduler::releaseDone()
+{
+	m_done.clear();
+}
+
+void ResolveScheduler::resolved(bool)
+{
+	RemoteService* service = static_cast<RemoteService*>(const_cast<QObject*>(sender()));
+	// result is the same for all owners of shared service, entry is deleted with last job
+	ServiceJobs* jobs;
+	while ((jobs = m_jobs.find(service)) && !jobs->m_running.isEmpty())
+		retire(jobs->m_running.first());
+	restartTimer();
+	schedule();
+}
+
+void ResolveScheduler::timedOut()
+{
+	uint now = timestamp();
+	while (m_timeout>=0 && !m_running.isEmpty() && (int)(now-m_running.first().m_time)>=m_timeout) {
+		Job job = m_running.first();
+		retire(m_running.begin());
+		// stop resolving and report failure to owner, as if resolver did
+		ErrorEvent err;
+		QApplication::sendEvent(job.m_service, &err);
+	}
+	restartTimer();
+	schedule();
+}
+
+}
+
+#include "resolvescheduler.moc"
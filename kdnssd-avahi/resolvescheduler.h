@@ -0,0 +1,172 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DNSSDRESOLVESCHEDULER_H
+#define DNSSDRESOLVESCHEDULER_H
+
+#include <qobject.h>
+#include <qtimer.h>
+#include <qptrlist.h>
+#include <qptrdict.h>
+#include <qvaluelist.h>
+#include <dnssd/remoteservice.h>
+
+namespace DNSSD
+{
+
+/**
+Process-wide queue of services waiting to be resolved. Only limited number of resolves
+run at once, the rest waits in queue. Waiting services are served by priority and, within
+one priority, round robin between owners (usually ServiceBrowsers), so one owner with
+thousands of services does not hold back others. Every service is resolved in order
+in which owner enqueued it.
+
+Resolve that takes longer than timeout() is stopped and reported as failed.
+
+Time spent in queue is recorded as Statistics::ResolveWait.
+
+@short Limits number of resolves running at once
+ */
+class KDNSSD_EXPORT ResolveScheduler : public QObject
+{
+	Q_OBJECT
+public:
+	/**
+	@li High - resolved before everything else, for example services user just selected
+	@li Normal - default
+	@li Low - resolved only when nothing else waits
+	 */
+	enum Priority { High, Normal, Low, Priorities };
+
+	static ResolveScheduler& self();
+	~ResolveScheduler();
+
+	/**
+	Queues service for resolving. Its resolveAsync() is called later and owner should
+	connect to its resolved() signal.
+	@param owner Object on whose behalf service is resolved, used for fair scheduling and
+	cancel()
+	@param uncached Daemon is asked even if service is resolved or its result is in resolve
+	cache, used to check that service is still there
+	 */
+	void enqueue(RemoteService::Ptr service, QObject* owner, Priority priority=Normal,
+		bool uncached=false);
+
+	/**
+	Removes service from queue. If it is already being resolved, scheduler forgets about
+	it and resolving goes on until service is stopped or destroyed.
+	 */
+	void cancel(RemoteService* service, QObject* owner);
+
+	/**
+	Removes all services of given owner. Has to be called before owner is destroyed.
+	 */
+	void cancel(QObject* owner);
+
+	/**
+	Sets maximum number of resolves running at once. Default is 10
+	 */
+	void setMaxResolves(uint count);
+	uint maxResolves() const;
+
+	/**
+	Sets time in milliseconds after which resolve is stopped and reported as failed.
+	Default is 10 seconds, -1 means no timeout
+	 */
+	void setTimeout(int timeout);
+	int timeout() const;
+
+	/**
+	Returns number of services waiting in queue
+	 */
+	uint queued() const;
+
+	/**
+	Returns number of resolves running now
+	 */
+	uint running() const;
+
+private slots:
+	void resolved(bool);
+	void timedOut();
+	void releaseDone();
+private:
+	ResolveScheduler();
+
+	struct Job
+	{
+		RemoteService::Ptr m_service;
+		QObject* m_owner;
+		// time of enqueue(), then of start of resolving
+		uint m_time;
+		bool m_uncached;
+	};
+	// waiting jobs of one owner with one priority
+	struct OwnerQueue
+	{
+		QObject* m_owner;
+		Priority m_priority;
+		QValueList<Job> m_jobs;
+	};
+	// waiting job and queue it waits in
+	struct Waiting
+	{
+		OwnerQueue* m_queue;
+		QValueList<Job>::Iterator m_job;
+	};
+	// all jobs of one service, one per owner at most
+	struct ServiceJobs
+	{
+		QValueList<Waiting> m_waiting;
+		// positions in m_running
+		QValueList<QValueList<Job>::Iterator> m_running;
+	};
+
+	bool take(Job& job);
+	void schedule();
+	void restartTimer();
+	bool isRunning(RemoteService* service) const;
+	// returns jobs of service, creating empty entry if there is none
+	ServiceJobs* jobsOf(RemoteService* service);
+	// removes entry of service if it has no more jobs
+	void releaseJobs(RemoteService* service, ServiceJobs* jobs);
+	// removes waiting job from its queue
+	void unqueue(ServiceJobs* jobs, QValueList<Waiting>::Iterator waiting);
+	// drops running job and returns the next one. Service may be emitting signal right
+	// now, so it is released later
+	QValueList<Job>::Iterator retire(QValueList<Job>::Iterator job);
+
+	static ResolveScheduler* m_self;
+
+	// owners with waiting jobs for each priority, served round robin
+	QPtrList<OwnerQueue> m_waiting[Priorities];
+	// in order of start, so first one times out first
+	QValueList<Job> m_running;
+	// jobs by service, so cancel() does not search queues
+	QPtrDict<ServiceJobs> m_jobs;
+	QValueList<RemoteService::Ptr> m_done;
+	QTimer m_timer;
+	uint m_max;
+	int m_timeout;
+	uint m_queued;
+	bool m_scheduling;
+};
+
+}
+
+#endif
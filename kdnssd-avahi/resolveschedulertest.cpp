@@ -0,0 +1,128 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+Checks order in which ResolveScheduler serves priorities and owners, cancel() of owner
+and timeout of resolves. Daemon is stood in by avahi_client_new() that does not return
+for a while, so resolves wait for client until scheduler gives up on them.
+*/
+
+#include <stdio.h>
+#include <qapplication.h>
+#include <qdatetime.h>
+#include <qstringlist.h>
+#include <kinstance.h>
+#include "resolvescheduler.h"
+#include "responder.h"
+#include "benchclient.h"
+
+// client is not running for this long
+#define DELAY 3000
+// timeout of resolves in ms, clocks may differ by a millisecond or two
+#define TIMEOUT 50
+
+using namespace DNSSD;
+
+static int failures = 0;
+
+static void check(const char* what, bool ok)
+{
+	printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) failures++;
+}
+
+// records order and time of finished resolves
+class Recorder : public QObject
+{
+	Q_OBJECT
+public:
+	Recorder() { m_time.start(); }
+	QStringList m_order;
+	QValueList<int> m_times;
+	QTime m_time;
+public slots:
+	void resolved(bool ok)
+	{
+		const RemoteService* service = static_cast<const RemoteService*>(sender());
+		m_order.append(ok ? service->serviceName()+"!" : service->serviceName());
+		m_times.append(m_time.elapsed());
+	}
+};
+
+static Recorder* recorder;
+
+static RemoteService::Ptr service(const char* name)
+{
+	RemoteService::Ptr s = new RemoteService(name, "_test._tcp", "local.");
+	QObject::connect(s, SIGNAL(resolved(bool)), recorder, SLOT(resolved(bool)));
+	return s;
+}
+
+static bool connecting()
+{
+	return Responder::self().state()!=AVAHI_CLIENT_S_RUNNING && !Responder::self().failed();
+}
+
+int main(int argc, char** argv)
+{
+	KInstance instance("resolveschedulertest");
+	QApplication app(argc, argv, false);
+	setClientDelay(DELAY);
+	Responder::prewarm();
+	if (!connecting()) {
+		printf("SKIP: client is not waiting for daemon\n");
+		return 0;
+	}
+	Recorder rec;
+	recorder = &rec;
+	ResolveScheduler& scheduler = ResolveScheduler::self();
+	scheduler.setMaxResolves(1);
+	scheduler.setTimeout(TIMEOUT);
+	QObject a, b, c, d;
+
+	scheduler.enqueue(service("a1"), &a);
+	scheduler.enqueue(service("a2"), &a);
+	scheduler.enqueue(service("a3"), &a);
+	scheduler.enqueue(service("b1"), &b);
+	scheduler.enqueue(service("b2"), &b);
+	scheduler.enqueue(service("d1"), &d);
+	scheduler.enqueue(service("c1"), &c, ResolveScheduler::High);
+	check("only one resolve runs", scheduler.running()==1 && scheduler.queued()==6);
+	scheduler.cancel(&d);
+	check("cancelled owner leaves queue", scheduler.queued()==5);
+
+	QTime time;
+	time.start();
+	while (rec.m_order.count()<6 && time.elapsed()<DELAY/2) app.processEvents(TIMEOUT/5);
+	if (!connecting()) {
+		printf("SKIP: client stopped waiting for daemon\n");
+		return 0;
+	}
+	check("high priority first, then owners take turns",
+		rec.m_order.join(" ")=="a1 c1 a2 b1 a3 b2");
+	bool timedOut = rec.m_times.count()==6;
+	for (uint i=0; timedOut && i<rec.m_times.count(); i++)
+		timedOut = rec.m_times[i]>=(int)(i+1)*(TIMEOUT-2);
+	check("every resolve ran until timeout", timedOut);
+	check("nothing left", scheduler.running()==0 && scheduler.queued()==0);
+
+	printf("%s\n", failures ? "FAIL" : "PASS");
+	return failures ? 1 : 0;
+}
+
+#include "resolveschedulertest.moc"
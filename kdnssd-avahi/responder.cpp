@@ -19,12 +19,26 @@
  */
 
 #include "responder.h"
+#include "sdevent.h"
 #include <qapplication.h>
 #include <qeventloop.h>
+#include <qtimer.h>
 #include <kstaticdeleter.h>
 #include <kidna.h>
 #include <kdebug.h>
+#include <sys/time.h>
 #include <avahi-qt3/qt-watch.h>
+#include <avahi-common/simple-watch.h>
+#ifdef QT_THREAD_SUPPORT
+#include <qthread.h>
+#endif
+#ifdef KDNSSD_THREADED
+#include <avahi-common/thread-watch.h>
+#endif
+
+// delays between attempts to reconnect to daemon, in milliseconds
+#define RETRY_MIN 500
+#define RETRY_MAX 30000
 
 
 namespace DNSSD
@@ -32,49 +46,396 @@ namespace DNSSD
 
 static KStaticDeleter<Responder> responder_sd;
 Responder* Responder::m_self = 0;
+bool Responder::m_threaded = false;
+uint Responder::m_connections = 1;
+Responder::Placement Responder::m_placement = Responder::LeastLoaded;
+uint Responder::m_next = 0;
 
-void client_callback(AvahiClient *, AvahiClientState s, void* u) 
+void client_callback(AvahiClient *c, AvahiClientState s, void* u) 
 {
+    countCallback();
     Responder *r = reinterpret_cast<Responder*>(u);    
-    emit (r->stateChanged(s));
+#ifdef AVAHI_API_0_6
+    if (s==AVAHI_CLIENT_FAILURE) {
+#else
+    if (s==AVAHI_CLIENT_DISCONNECTED) {
+#endif
+	// client failing inside avahi_client_new() is freed by it
+	if (!r->m_connecting) r->connectionLost();
+    } else {
+	// first call comes before avahi_client_new() returns
+	r->m_client = c;
+	if (s==AVAHI_CLIENT_S_RUNNING) r->connectionReady();
+    }
+    // state changes have to be reported from GUI thread
+    if (r->isThreaded()) QApplication::postEvent(r, new ClientStateEvent(s));
+	else emit (r->stateChanged(s));
+}
+
+#ifdef QT_THREAD_SUPPORT
+static void probe_callback(AvahiClient*, AvahiClientState, void*)
+{
+}
+
+/*
+Creates and frees client with its own poll, so blocking D-Bus handshake and daemon
+startup are waited for off GUI thread. Responder is told to connect when it is done,
+its own client is then created quickly. Outcome does not matter, failure is found by
+Responder itself.
+*/
+class ConnectProbe : public QThread
+{
+public:
+	ConnectProbe(Responder* responder) : m_responder(responder) {}
+protected:
+	virtual void run()
+	{
+		AvahiSimplePoll* poll = avahi_simple_poll_new();
+		if (poll) {
+			int error;
+#ifdef AVAHI_API_0_6
+			AvahiClient* client = avahi_client_new(avahi_simple_poll_get(poll),
+				AVAHI_CLIENT_IGNORE_USER_CONFIG, probe_callback, 0, &error);
+#else
+			AvahiClient* client = avahi_client_new(avahi_simple_poll_get(poll),
+				probe_callback, 0, &error);
+#endif
+			if (client) avahi_client_free(client);
+			avahi_simple_poll_free(poll);
+		}
+		QApplication::postEvent(m_responder, new QCustomEvent(QEvent::User+SD_PROBED));
+	}
+private:
+	Responder* m_responder;
+};
+#endif
+
+void dispatch_callback(AvahiTimeout*, void* context)
+{
+    // avahi thread, client is locked
+    Responder *r = reinterpret_cast<Responder*>(context);
+    if (r->m_connecting || r->m_retry) r->connectClient();
+	else if (r->m_client && avahi_client_get_state(r->m_client)==AVAHI_CLIENT_S_RUNNING) r->createPending();
 }
 
 
-Responder::Responder()
+Responder::Responder() : m_client(0), m_deadClient(0), m_poll(0), m_dispatch(0), m_probe(0),
+    m_connecting(true),
+    m_retry(false), m_retryDelay(RETRY_MIN), m_recoveryTime(-1)
+{
+    m_objects.setAutoDelete(false);
+    for (int i=0; i<ObjectKinds; i++) m_load[i] = 0;
+    m_others.setAutoDelete(true);
+#ifdef KDNSSD_THREADED
+    if (m_threaded) m_poll = avahi_threaded_poll_new();
+    if (m_poll) {
+	// connect from avahi thread
+	const AvahiPoll* poll = avahi_threaded_poll_get(m_poll);
+	struct timeval now;
+	gettimeofday(&now,0);
+	m_dispatch = poll->timeout_new(poll, &now, dispatch_callback, this);
+	avahi_threaded_poll_start(m_poll);
+	return;
+    }
+#endif
+    startConnect();
+}
+
+void Responder::startConnect()
+{
+#ifdef QT_THREAD_SUPPORT
+    if (!m_probe) m_probe = new ConnectProbe(this);
+    // previous probe has posted its event already
+    if (!m_probe->running()) m_probe->start();
+#else
+    // connect when control gets back to event loop
+    QTimer::singleShot(0, this, SLOT(connectClient()));
+#endif
+}
+
+void Responder::connectClient()
 {
+    if (!m_connecting && !m_retry) return;
+    m_connecting = true;
+    m_retry = false;
+    if (m_deadClient) avahi_client_free(m_deadClient);
+    m_deadClient = 0;
     int error;
     const AvahiPoll* poll = avahi_qt_poll_get();
+#ifdef KDNSSD_THREADED
+    if (m_poll) poll = avahi_threaded_poll_get(m_poll);
+#endif
+#ifdef AVAHI_API_0_6
+    AvahiClient* client = avahi_client_new(poll, AVAHI_CLIENT_IGNORE_USER_CONFIG,client_callback, this,  &error);
+#else
+    AvahiClient* client = avahi_client_new(poll, client_callback, this,  &error);
+#endif
+    m_client = client;
+    m_connecting = false;
+    if (m_client) return;
+    // failure after lost connection was already reported
+    bool report = (m_retryDelay==RETRY_MIN);
+    if (report) kdWarning() << "Failed to create avahi client" << endl;
+    scheduleRetry();
+    if (!report) return;
+    // queued objects are still created if reconnection succeeds, but owners must not wait
+    for (ClientObject* obj = m_pending.first(); obj; obj = m_pending.next()) obj->createFailed();
+    // let waiting objects know
 #ifdef AVAHI_API_0_6
-    m_client = avahi_client_new(poll, AVAHI_CLIENT_IGNORE_USER_CONFIG,client_callback, this,  &error);
+    AvahiClientState s = AVAHI_CLIENT_FAILURE;
 #else
-    m_client = avahi_client_new(poll, client_callback, this,  &error);
+    AvahiClientState s = AVAHI_CLIENT_DISCONNECTED;
+#endif
+    if (isThreaded()) QApplication::postEvent(this, new ClientStateEvent(s));
+	else emit stateChanged(s);
+}
+
+void Responder::scheduleRetry()
+{
+    m_retry = true;
+#ifdef KDNSSD_THREADED
+    if (m_poll) {
+	struct timeval when;
+	gettimeofday(&when,0);
+	when.tv_sec += m_retryDelay/1000;
+	when.tv_usec += (m_retryDelay%1000)*1000;
+	if (when.tv_usec>=1000000) {
+	    when.tv_sec++;
+	    when.tv_usec -= 1000000;
+	}
+	avahi_threaded_poll_get(m_poll)->timeout_update(m_dispatch, &when);
+    } else
 #endif
-    if (!m_client) kdWarning() << "Failed to create avahi client" << endl;
+    QTimer::singleShot(m_retryDelay, this, SLOT(startConnect()));
+    m_retryDelay = QMIN(2*m_retryDelay, RETRY_MAX);
+}
+
+void Responder::connectionLost()
+{
+    kdWarning() << "Connection to avahi daemon lost, reconnecting" << endl;
+    // handles of dead client are useless, everything is created again after reconnection
+    m_deadClient = m_client;
+    m_client = 0;
+    m_pending.clear();
+    for (ClientObject* obj = m_objects.first(); obj; obj = m_objects.next()) {
+	obj->destroy();
+	m_pending.append(obj);
+    }
+    m_lostTime.start();
+    scheduleRetry();
+}
+
+void Responder::connectionReady()
+{
+    if (m_lostTime.isValid()) {
+	m_recoveryTime = m_lostTime.elapsed();
+	m_lostTime = QTime();
+    }
+    m_retryDelay = RETRY_MIN;
+    createPending();
+}
+
+void Responder::createPending()
+{
+    for (ClientObject* obj = m_pending.first(); obj; obj = m_pending.next())
+	if (!obj->create(m_client)) obj->createFailed();
+    m_pending.clear();
+}
+
+void Responder::prewarm()
+{
+    self();
 }
+
  
 Responder::~Responder()
 {
+#ifdef QT_THREAD_SUPPORT
+    if (m_probe) {
+	// avahi_client_new() cannot be interrupted
+	m_probe->wait();
+	delete m_probe;
+    }
+#endif
+#ifdef KDNSSD_THREADED
+    if (m_poll) avahi_threaded_poll_stop(m_poll);
+#endif
     if (m_client) avahi_client_free(m_client);
+    if (m_deadClient) avahi_client_free(m_deadClient);
+#ifdef KDNSSD_THREADED
+    if (m_poll) avahi_threaded_poll_free(m_poll);
+#endif
 }
 
 Responder& Responder::self()
 {
-    if (!m_self) responder_sd.setObject(m_self, new Responder);
+    if (!m_self) {
+	responder_sd.setObject(m_self, new Responder);
+	for (uint i=1; i<m_connections; i++) m_self->m_others.append(new Responder);
+    }
     return *m_self;
 }
 
-void Responder::process()
+void Responder::setConnections(uint count, Placement placement)
+{
+    m_connections = QMAX(count,1u);
+    m_placement = placement;
+}
+
+uint Responder::connections()
+{
+    return self().m_others.count()+1;
+}
+
+Responder& Responder::connection(uint index)
+{
+    return (index) ? *self().m_others.at(index-1) : self();
+}
+
+Responder& Responder::pick(ObjectKind kind)
+{
+    uint count = connections();
+    if (count==1) return self();
+    if (m_placement==RoundRobin) {
+	// skip connections that failed
+	for (uint i=0; i<count; i++) {
+	    Responder& r = connection(m_next++ % count);
+	    if (!r.failed()) return r;
+	}
+	return self();
+    }
+    Responder* best = &self();
+    for (uint i=1; i<count; i++) {
+	Responder* r = &connection(i);
+	if (r->failed()) continue;
+	if (best->failed() || r->load()<best->load() || 
+	    (r->load()==best->load() && r->load(kind)<best->load(kind))) best = r;
+    }
+    return *best;
+}
+
+uint Responder::load() const
+{
+    uint sum = 0;
+    for (int i=0; i<ObjectKinds; i++) sum+=m_load[i];
+    return sum;
+}
+
+void Responder::setThreaded(bool threaded)
+{
+    m_threaded = threaded;
+}
+
+void Responder::process(int timeout)
+{
+    // timer only has to wake the loop up
+    QTimer wakeUp;
+    if (timeout>=0) wakeUp.start(timeout,true);
+    qApp->eventLoop()->processEvents(QEventLoop::ExcludeUserInput | QEventLoop::WaitForMore);
+}
+
+bool Responder::attach(ClientObject* obj)
 {
-    qApp->eventLoop()->processEvents(QEventLoop::ExcludeUserInput);
+    lock();
+    if (failed()) {
+	unlock();
+	return false;
+    }
+    m_load[obj->m_kind]++;
+    m_objects.append(obj);
+    bool running = m_client && avahi_client_get_state(m_client)==AVAHI_CLIENT_S_RUNNING;
+    if (running && !m_poll) {
+	// GUI thread can create it right now
+	bool ok = obj->create(m_client);
+	if (!ok) {
+	    m_objects.removeRef(obj);
+	    m_load[obj->m_kind]--;
+	}
+	unlock();
+	return ok;
+    }
+#ifdef KDNSSD_THREADED
+    if (running && m_pending.isEmpty()) {
+	struct timeval now;
+	gettimeofday(&now,0);
+	avahi_threaded_poll_get(m_poll)->timeout_update(m_dispatch, &now);
+    }
+#endif
+    // otherwise it waits for client to get to running state
+    m_pending.append(obj);
+    unlock();
+    return true;
+}
+
+void Responder::detach(ClientObject* obj)
+{
+    lock();
+    if (m_objects.removeRef(obj) && m_load[obj->m_kind]) m_load[obj->m_kind]--;
+    m_pending.removeRef(obj);
+    obj->destroy();
+    unlock();
+}
+
+void Responder::lock() const
+{
+#ifdef KDNSSD_THREADED
+    if (m_poll) avahi_threaded_poll_lock(m_poll);
+#endif
+}
+
+void Responder::unlock() const
+{
+#ifdef KDNSSD_THREADED
+    if (m_poll) avahi_threaded_poll_unlock(m_poll);
+#endif
+}
+
+void Responder::customEvent(QCustomEvent* event)
+{
+    if (event->type()==QEvent::User+SD_STATE) emit stateChanged(static_cast<ClientStateEvent*>(event)->m_state);
+    if (event->type()==QEvent::User+SD_PROBED) connectClient();
+}
+
+int Responder::recoveryTime() const
+{
+    lock();
+    int time = m_recoveryTime;
+    unlock();
+    return time;
 }
 
 AvahiClientState Responder::state() const
 {
+	lock();
+	// not connected yet - looks like registering, callers wait for running state
+	AvahiClientState s = AVAHI_CLIENT_S_REGISTERING;
+	if (m_client) s = avahi_client_get_state(m_client);
+	    else if (!m_connecting) 
 #ifdef AVAHI_API_0_6
-	return (m_client) ? (avahi_client_get_state(m_client)) : AVAHI_CLIENT_FAILURE;
+		s = AVAHI_CLIENT_FAILURE;
 #else
-	return (m_client) ? (avahi_client_get_state(m_client)) : AVAHI_CLIENT_DISCONNECTED;
+		s = AVAHI_CLIENT_DISCONNECTED;
 #endif
+	unlock();
+	return s;
+}
+
+AvahiProtocol avahiProtocol(RemoteService::Protocol protocol)
+{
+	switch (protocol) {
+	    case RemoteService::IPv4: return AVAHI_PROTO_INET;
+	    case RemoteService::IPv6: return AVAHI_PROTO_INET6;
+	    default: return AVAHI_PROTO_UNSPEC;
+	}
+}
+
+RemoteService::Protocol fromAvahiProtocol(AvahiProtocol protocol)
+{
+	switch (protocol) {
+	    case AVAHI_PROTO_INET: return RemoteService::IPv4;
+	    case AVAHI_PROTO_INET6: return RemoteService::IPv6;
+	    default: return RemoteService::AnyProtocol;
+	}
 }
 
 bool domainIsLocal(const QString& domain)
@@ -24,13 +24,76 @@
 #include <qobject.h>
 #include <qsocketnotifier.h>
 #include <qsignal.h>
+#include <qptrlist.h>
+#include <qdatetime.h>
 #include <config.h>
 #include <avahi-client/client.h>
+#include <dnssd/remoteservice.h>
+#include "statistics.h"
+
+#if defined(AVAHI_THREADED_POLL) && defined(QT_THREAD_SUPPORT)
+#define KDNSSD_THREADED 1
+#endif
+
+struct AvahiThreadedPoll;
+struct AvahiTimeout;
+
 namespace DNSSD
 {
+class ConnectProbe;
+
+/**
+Kinds of objects placed on client connections. Used for load accounting.
+ */
+enum ObjectKind { BrowserObject, ResolverObject, PublisherObject, ObjectKinds };
+
+/**
+Base for private classes that own avahi browsers or resolvers. Objects are
+passed to Responder::attach() and Responder::detach() which call create() and
+destroy() with client locked. In threaded mode create() is called later from avahi
+thread, so it must not touch anything that GUI thread may change in meantime.
+Same applies to createFailed(), which reports failure of create() that was not called
+directly by attach().
+
+@short Internal interface of avahi object owners
+ */
+class ClientObject
+{
+public:
+	ClientObject(ObjectKind kind) : m_kind(kind) {}
+	virtual ~ClientObject() {}
+	/**
+	Creates avahi objects using given client. Returns false on failure
+	 */
+	virtual bool create(AvahiClient* client) = 0;
+	/**
+	Frees avahi objects
+	 */
+	virtual void destroy() = 0;
+	/**
+	Called when delayed create() fails, or when object is queued and first connection
+	attempt fails. Object stays queued in the latter case. Has to post the failure to
+	owner, it must not report it synchronously
+	 */
+	virtual void createFailed() {}
+
+	const ObjectKind m_kind;
+};
 
 /**
 This class should not be used directly.
+
+Each Responder wraps one connection to avahi daemon. self() is the primary one,
+used for checking daemon state. If more connections are configured with
+setConnections(), objects are spread over them by pick().
+
+Connecting does not block: in threaded mode client is created on avahi thread. Otherwise
+helper thread first waits until daemon answers on throwaway client, so the real one
+created from event loop does not stall GUI while daemon is starting. Objects attached
+before client gets to running state are created when it does.
+
+When connection to daemon is lost, all attached objects are destroyed and Responder
+tries to reconnect with increasing delays. Objects are created again once it succeeds.
  
 @author Jakub Stachowski
 @short Internal class wrapping avahi client
@@ -45,20 +108,179 @@ public:
 	~Responder();
 
 	static Responder& self();
+
+	/**
+	Policies of placing new objects on connections
+	@li LeastLoaded - connection with smallest number of objects
+	@li RoundRobin - connections are used in turn
+	 */
+	enum Placement { LeastLoaded, RoundRobin };
+
+	/**
+	Sets number of client connections and policy of placing objects on them. Has to be
+	called before first use of any DNSSD class. Default is one connection.
+	 */
+	static void setConnections(uint count, Placement placement=LeastLoaded);
+
+	/**
+	Returns number of client connections
+	 */
+	static uint connections();
+
+	/**
+	Returns connection with given index. Connection 0 is self()
+	 */
+	static Responder& connection(uint index);
+
+	/**
+	Returns connection that new object of given kind should be placed on
+	 */
+	static Responder& pick(ObjectKind kind);
+
+	/**
+	Returns number of objects of given kind placed on this connection
+	 */
+	uint load(ObjectKind kind) const { return m_load[kind]; }
+
+	/**
+	Returns number of all objects placed on this connection
+	 */
+	uint load() const;
+
+	/**
+	Makes avahi client run on its own thread using avahi_threaded_poll instead of Qt
+	event loop. Browsers and resolvers are then created on that thread and results are
+	passed to GUI thread through event queues. This has to be called before first use of
+	any DNSSD class. It is ignored if avahi or Qt were built without thread support.
+	 */
+	static void setThreaded(bool threaded);
+	bool isThreaded() const { return m_poll!=0; }
+
+	/**
+	Starts connecting to daemon in background, so it is likely to be ready when
+	first DNSSD object is used. Optional, call it early during application startup.
+	Without Qt thread support only creating client is postponed to event loop.
+	 */
+	static void prewarm();
+
+	/**
+	Returns client state. Until connection attempt finishes it is reported as
+	AVAHI_CLIENT_S_REGISTERING.
+	 */
 	AvahiClientState state() const;
 	AvahiClient* client() const { return m_client; }
-	void process();
+	/**
+	Returns true if there is no client and no connection attempt is running, also when
+	reconnection is pending. New objects cannot be attached then and callers report
+	failure instead of waiting for daemon to come back.
+	 */
+	bool failed() const { return !m_connecting && !m_client; }
+	/**
+	Returns true if client is down and reconnection is pending
+	 */
+	bool retryPending() const { return failed() && m_retry; }
+	/**
+	Returns time in milliseconds it took to get back to running state after
+	connection to daemon was lost last time, or -1 if it was never lost
+	 */
+	int recoveryTime() const;
+	/**
+	Processes pending events, sleeping until at least one arrives or timeout
+	(in milliseconds) passes. Negative timeout means no limit.
+	 */
+	void process(int timeout=-1);
+
+	/**
+	Lets obj create its avahi objects. It is done immediately only if client is
+	running and not threaded, otherwise obj is queued until it is. Returns false if
+	failed(), or if immediate create() failed. In both cases obj is not attached. Failure
+	of queued create() is reported by createFailed(). create() is called again after
+	reconnection to daemon.
+	 */
+	bool attach(ClientObject* obj);
+	/**
+	Frees avahi objects owned by obj and cancels pending attach()
+	 */
+	void detach(ClientObject* obj);
+
+	/**
+	Locks client. Has to be held by GUI thread when calling avahi functions in threaded
+	mode. Does nothing otherwise. Lock is not recursive.
+	 */
+	void lock() const;
+	void unlock() const;
 signals:
 	void stateChanged(AvahiClientState);
+protected:
+	virtual void customEvent(QCustomEvent* event);
+private slots:
+	void connectClient();
+	// connects after daemon is known to answer
+	void startConnect();
 private:
+	// following are called with client locked
+	void scheduleRetry();
+	void connectionLost();
+	void connectionReady();
+	// creates queued objects, client has to be running
+	void createPending();
+
 	AvahiClient* m_client;
+	// client that lost connection, freed before reconnecting
+	AvahiClient* m_deadClient;
+	AvahiThreadedPoll* m_poll;
+	AvahiTimeout* m_dispatch;
+	// waits for daemon in non-threaded mode, 0 without thread support
+	ConnectProbe* m_probe;
+	volatile bool m_connecting;
+	volatile bool m_retry;
+	int m_retryDelay;
+	QTime m_lostTime;
+	int m_recoveryTime;
+	// all attached objects, created or not
+	QPtrList<ClientObject> m_objects;
+	QPtrList<ClientObject> m_pending;
+	uint m_load[ObjectKinds];
+	// additional connections, owned by primary one
+	QPtrList<Responder> m_others;
 	static Responder* m_self;
+	static bool m_threaded;
+	static uint m_connections;
+	static Placement m_placement;
+	static uint m_next;
 	friend void client_callback(AvahiClient*, AvahiClientState, void*);
+	friend void dispatch_callback(AvahiTimeout*, void*);
 
 };
 
+/**
+Keeps client locked while in scope
+ */
+class ClientLocker
+{
+public:
+	ClientLocker(const Responder& r) : m_responder(r) { m_responder.lock(); }
+	~ClientLocker() { m_responder.unlock(); }
+private:
+	const Responder& m_responder;
+};
+
+/* Statistics hooks */
+
+void countObject(Statistics::Object object, int delta);
+void countCallback();
+void countEvent();
+void countFlap();
+// milliseconds of monotonic clock, for measuring latencies and ages. Unaffected by
+// changes of system time
+uint timestamp();
+void recordLatency(Statistics::Latency latency, uint start);
+
 /* Utils functions */
 
+AvahiProtocol avahiProtocol(RemoteService::Protocol protocol);
+RemoteService::Protocol fromAvahiProtocol(AvahiProtocol protocol);
+
 bool domainIsLocal(const QString& domain);
 // Encodes domain name using utf8() or IDN 
 QCString domainToDNS(const QString &domain);
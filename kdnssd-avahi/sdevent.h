@@ -24,11 +24,15 @@
 #include <qevent.h>
 #include <qstring.h>
 #include <qmap.h>
+#include <avahi-client/client.h>
+
+struct AvahiStringList;
 
 namespace DNSSD
 {
 
-enum Operation { SD_ERROR = 101,SD_ADDREMOVE, SD_PUBLISH, SD_RESOLVE};
+enum Operation { SD_ERROR = 101,SD_ADDREMOVE, SD_PUBLISH, SD_RESOLVE, SD_STATE, SD_SERVICE,
+	SD_PROBED};
 
 class ErrorEvent : public QCustomEvent
 {
@@ -36,19 +40,49 @@ public:
 	ErrorEvent() : QCustomEvent(QEvent::User+SD_ERROR) 
 	{}
 };
+/**
+Posted by AddRemoveQueue when first event of batch arrives. Actual events are
+taken from the queue by receiver. Reset means that browser was created again after
+reconnection to daemon and following events describe current state. CacheExhausted, AllForNow
+and Failure carry AVAHI_BROWSER_CACHE_EXHAUSTED, AVAHI_BROWSER_ALL_FOR_NOW and
+AVAHI_BROWSER_FAILURE.
+
+Qt deletes posted events after delivery, so memory of deleted events is kept in a small
+free list and reused by next ones instead of going back to heap.
+ */
 class AddRemoveEvent : public QCustomEvent
 {
 public:
-	enum Operation { Add, Remove };
-	AddRemoveEvent(Operation op,const QString& name,const QString& type,
-		const QString& domain) : QCustomEvent(QEvent::User+SD_ADDREMOVE),
-	m_op(op), m_name(name), m_type(type), m_domain(domain) 
+	enum Operation { Add, Remove, Reset, CacheExhausted, AllForNow, Failure };
+	AddRemoveEvent() : QCustomEvent(QEvent::User+SD_ADDREMOVE)
+	{}
+	static void* operator new(size_t size);
+	static void operator delete(void* p);
+};
+
+/**
+Sent (not posted) by SharedBrowser to its subscribers, strings are only borrowed.
+Query posts Replay to itself to subscribe.
+ */
+class ServiceEvent : public QCustomEvent
+{
+public:
+	enum Operation { Add, Remove, CacheExhausted, Finished, Failed, Replay };
+	ServiceEvent(Operation op, int interface=-1, int protocol=-1, const QString& name=QString::null,
+		const QString& type=QString::null, const QString& domain=QString::null, bool cached=false)
+		: QCustomEvent(QEvent::User+SD_SERVICE), m_op(op), m_interface(interface),
+		m_protocol(protocol), m_name(name), m_type(type), m_domain(domain), m_cached(cached)
 	{}
 
 	const Operation m_op;
-	const QString m_name;
-	const QString m_type;
-	const QString m_domain;
+	// avahi interface index and protocol of result or, for Finished and Failed, of browser
+	const int m_interface;
+	const int m_protocol;
+	const QString& m_name;
+	const QString& m_type;
+	const QString& m_domain;
+	// Add was answered from daemon's cache
+	const bool m_cached;
 };
 
 class PublishEvent : public QCustomEvent
@@ -60,20 +94,32 @@ public:
 	bool m_ok;
 };
 
+/**
+Sent (not posted) from resolver callback, so it only borrows data owned by avahi.
+Receiver has to copy everything it needs before returning. In threaded mode it is
+posted without any data and receiver takes result left by callback.
+ */
 class ResolveEvent : public QCustomEvent
 {
 public:
-	ResolveEvent(const QString& hostname, unsigned short port,
-		     const QMap<QString,QString>& txtdata) 
+	ResolveEvent(const char* hostname, unsigned short port, AvahiStringList* txt)
 		: QCustomEvent(QEvent::User+SD_RESOLVE), m_hostname(hostname),
-		  m_port(port), m_txtdata(txtdata)
+		  m_port(port), m_txt(txt)
 	{}
 
-	const QString m_hostname;
+	const char* const m_hostname;
 	const unsigned short m_port;
-	const QMap<QString,QString> m_txtdata;
+	AvahiStringList* const m_txt;
 };
 
+class ClientStateEvent : public QCustomEvent
+{
+public:
+	ClientStateEvent(AvahiClientState state) : QCustomEvent(QEvent::User+SD_STATE), m_state(state)
+	{}
+
+	const AvahiClientState m_state;
+};
 
 }
 
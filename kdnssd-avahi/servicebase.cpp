@@ -42,6 +42,11 @@ QString ServiceBase::encode()
 // 3rd\.\032Floor\032Copy\032Room.dns-sd.org  - domain
 // 	_ipp._tcp.dns-sd.org	- metaquery
 
+QString ServiceBase::subtypeName(const QString& subtype, const QString& type)
+{
+	return subtype+"._sub."+type;
+}
+
 void ServiceBase::decode(const QString& name)
 {
 	QString rest;
@@ -86,6 +86,13 @@ public:
 	 */
 	const QMap<QString,QString>& textData() const;
 
+	/**
+	Returns name of subtype of service type as defined by RFC 6763, for example
+	"_printer._sub._http._tcp" for "_printer" and "_http._tcp". It can be passed as type
+	to Query to find only services of that subtype.
+	 */
+	static QString subtypeName(const QString& subtype, const QString& type);
+
 protected:
 	QString m_serviceName;
 	QString m_type;
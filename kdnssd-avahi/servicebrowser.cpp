@@ -26,9 +26,16 @@
 #include "responder.h"
 #include "query.h"
 #include "servicebrowser.h"
+#include "browsecache.h"
+#include <qptrlist.h>
+#include <qtimer.h>
 #include <avahi-client/client.h>
 #include <config.h>
 
+#define JOURNAL_SIZE 1000
+// initial size of index of one query's services, it is doubled as it fills up
+#define GROUP_SIZE 61
+
 namespace DNSSD
 {
 
@@ -37,18 +44,262 @@ const QString ServiceBrowser::AllServices = "_services._dns-sd._udp";
 class ServiceBrowserPrivate 
 {
 public:	
-	ServiceBrowserPrivate() : m_running(false) 
-	{}
+	ServiceBrowserPrivate() : m_listChanged(false), m_index(1021), m_byQuery(61), m_resolving(0), m_running(false),
+		m_cacheExhausted(false), m_queries(17), m_protocol(RemoteService::AnyProtocol),
+		m_resolvePriority(ResolveScheduler::Normal), m_journalSize(JOURNAL_SIZE), m_generation(0),
+		m_dropped(0), m_batchInterval(0), m_maxAge(0), m_dampingInterval(0)
+	{
+		m_index.setAutoDelete(true);
+		m_byQuery.setAutoDelete(true);
+		m_queries.setAutoDelete(true);
+	}
+	struct Entry
+	{
+		Entry() : m_rejected(false), m_seenBy(0), m_verifying(false), m_removing(false), m_port(0) { m_firstSeen = m_lastSeen = timestamp(); }
+		ServiceRecord m_record;
+		// created only when somebody needs it, see service()
+		RemoteService::Ptr m_service;
+		// live service replacing one loaded from disk cache, set while it is resolved
+		RemoteService::Ptr m_live;
+		// position in m_listed, valid only when service is listed
+		QValueList<Entry*>::Iterator m_it;
+		// false while service is being resolved
+		bool m_listed;
+		// resolved, but TXT does not match filter. Kept unlisted and connected, so it is
+		// listed when TXT changes
+		bool m_rejected;
+		// loaded from disk cache and not seen since
+		bool m_stale;
+		// type of query that found it
+		QString m_queryType;
+		// number of queries reporting it, more than one when several subtypes match
+		uint m_seenBy;
+		// timestamps in ms, last seen is updated by every sign of life
+		uint m_firstSeen;
+		uint m_lastSeen;
+		// listed service is resolved again to check that it is still there
+		bool m_verifying;
+		// listed service is no longer announced, but it may come back within damping interval
+		bool m_removing;
+		uint m_removedAt;
+		// host, port and TXT of listed service as last reported, resolves that do not
+		// change them are not journaled
+		QString m_hostName;
+		unsigned short m_port;
+		QMap<QString,QString> m_textData;
+		// stores data of svr, returns false if they are the same as stored ones
+		bool remember(const RemoteService::Ptr& svr)
+		{
+			if (svr->hostName()==m_hostName && svr->port()==m_port && svr->textData()==m_textData)
+				return false;
+			m_hostName = svr->hostName();
+			m_port = svr->port();
+			m_textData = svr->textData();
+			return true;
+		}
+	};
+	ServiceBrowser* m_browser;
+	// listed entries in order they were added
+	QValueList<Entry*> m_listed;
+	// their services, rebuilt by services() after m_listed changes
 	QValueList<RemoteService::Ptr> m_services;
-	QValueList<RemoteService::Ptr> m_duringResolve;
+	bool m_listChanged;
+	// all known services including ones being resolved, by serviceKey()
+	QDict<Entry> m_index;
+	// the same entries grouped by queryKey() of query that found them
+	QDict<QDict<Entry> > m_byQuery;
+	uint m_resolving;
 	QStringList m_types;
+	QStringList m_subtypes;
 	DomainBrowser* m_domains;
 	int m_flags;
 	bool m_running;
 	bool m_finished;
-	QDict<Query> resolvers;
+	// cacheExhausted() was emitted
+	bool m_cacheExhausted;
+	// queries by queryKey()
+	QDict<Query> m_queries;
+	QValueList<int> m_interfaces;
+	RemoteService::Protocol m_protocol;
+	ResolveScheduler::Priority m_resolvePriority;
+	ServiceFilter m_filter;
+
+	// types passed to queries - subtypes of each type if they are set
+	QStringList queryTypes() const;
+	// all queries in domain have finished
+	bool isFinished(const QString& domain) const;
+
+	// services have to be resolved before they are listed
+	bool mustResolve() const { return (m_flags & ServiceBrowser::AutoResolve) ||
+		m_filter.hasTextConditions(); }
+
+	struct Change
+	{
+		ServiceChange::Type m_type;
+		ServiceRecord m_record;
+		// null if service object did not exist yet
+		RemoteService::Ptr m_service;
+		QString m_key;
+		uint m_generation;
+	};
+	// last changes of m_listed, oldest first
+	QValueList<Change> m_journal;
+	uint m_journalSize;
+	uint m_generation;
+	// changes up to this generation are no longer in journal
+	uint m_dropped;
+
+	// changes of the same kind waiting for servicesAdded() or servicesRemoved()
+	QValueList<RemoteService::Ptr> m_batch;
+	ServiceChange::Type m_batchType;
+	QTimer m_batchTimer;
+	int m_batchInterval;
+
+	// in seconds, 0 - services never age
+	int m_maxAge;
+	QTimer m_sweepTimer;
+
+	// in ms, 0 - removals are reported immediately
+	int m_dampingInterval;
+	// keys of services with pending removal, oldest first
+	QStringList m_dying;
+	QTimer m_dampingTimer;
+
+	void journal(ServiceChange::Type type, const Entry* e, const QString& key);
+	void trimJournal();
+	// returns service of entry, creating it if needed
+	RemoteService::Ptr service(Entry* e);
+	void list(Entry* e);
+	void unlist(Entry* e);
+	// returns entries found by query for type in domain, 0 if there are none
+	QDict<Entry>* group(const QString& type, const QString& domain) const;
+	// adds entry to m_index and to its group
+	void insert(Entry* e, const QString& key);
+	void addToGroup(Entry* e, const QString& key);
+	void removeFromGroup(Entry* e, const QString& key);
 };
 
+QStringList ServiceBrowserPrivate::queryTypes() const
+{
+	if (m_subtypes.isEmpty()) return m_types;
+	QStringList types;
+	QStringList::ConstIterator itEnd = m_types.end();
+	QStringList::ConstIterator subEnd = m_subtypes.end();
+	for (QStringList::ConstIterator it = m_types.begin(); it!=itEnd; ++it)
+		for (QStringList::ConstIterator sub = m_subtypes.begin(); sub!=subEnd; ++sub)
+			types.append(ServiceBase::subtypeName(*sub,*it));
+	return types;
+}
+
+RemoteService::Ptr ServiceBrowserPrivate::service(Entry* e)
+{
+	if (!e->m_service) {
+		e->m_service = e->m_record.remoteService();
+		// resolves of listed services are journaled
+		QObject::connect(e->m_service,SIGNAL(resolved(bool )),m_browser,SLOT(serviceResolved(bool )));
+	}
+	return e->m_service;
+}
+
+void ServiceBrowserPrivate::list(Entry* e)
+{
+	e->m_listed = true;
+	if (e->m_service) e->remember(e->m_service);
+	e->m_it = m_listed.append(e);
+	m_listChanged = true;
+}
+
+void ServiceBrowserPrivate::unlist(Entry* e)
+{
+	m_listed.remove(e->m_it);
+	m_listChanged = true;
+}
+
+void ServiceBrowserPrivate::journal(ServiceChange::Type type, const Entry* e, const QString& key)
+{
+	Change c;
+	c.m_type = type;
+	c.m_record = e->m_record;
+	c.m_service = e->m_service;
+	c.m_key = key;
+	c.m_generation = ++m_generation;
+	m_journal.append(c);
+	trimJournal();
+}
+
+void ServiceBrowserPrivate::trimJournal()
+{
+	while (m_journal.count()>m_journalSize) {
+		m_dropped = m_journal.first().m_generation;
+		m_journal.remove(m_journal.begin());
+	}
+}
+
+// domains are compared without trailing dot
+static inline QString domainKey(const QString& domain)
+{
+	return (domain.endsWith(".")) ? domain.left(domain.length()-1) : domain;
+}
+
+// name and type are prefixed by length, so key is unambiguous whatever they contain
+static QString serviceKey(const QString& name, const QString& type, const QString& domain)
+{
+	return QString::number(name.length())+':'+name+QString::number(type.length())+':'+type+
+		domainKey(domain);
+}
+
+// types cannot contain '/'
+static inline QString queryKey(const QString& type, const QString& domain)
+{
+	return type+'/'+domainKey(domain);
+}
+
+QDict<ServiceBrowserPrivate::Entry>* ServiceBrowserPrivate::group(const QString& type,
+	const QString& domain) const
+{
+	return m_byQuery.find(queryKey(type, domain));
+}
+
+void ServiceBrowserPrivate::insert(Entry* e, const QString& key)
+{
+	m_index.insert(key, e);
+	if (m_index.count()>m_index.size()) m_index.resize(m_index.size()*2+1);
+	addToGroup(e, key);
+}
+
+void ServiceBrowserPrivate::addToGroup(Entry* e, const QString& key)
+{
+	QString gk = queryKey(e->m_queryType, e->m_record.domain());
+	QDict<Entry>* g = m_byQuery.find(gk);
+	if (!g) {
+		g = new QDict<Entry>(GROUP_SIZE);
+		m_byQuery.insert(gk, g);
+	}
+	g->insert(key, e);
+	// QDict never rehashes by itself
+	if (g->count()>g->size()) g->resize(g->size()*2+1);
+}
+
+void ServiceBrowserPrivate::removeFromGroup(Entry* e, const QString& key)
+{
+	QString gk = queryKey(e->m_queryType, e->m_record.domain());
+	QDict<Entry>* g = m_byQuery.find(gk);
+	if (!g) return;
+	g->remove(key);
+	if (g->isEmpty()) m_byQuery.remove(gk);
+}
+
+bool ServiceBrowserPrivate::isFinished(const QString& domain) const
+{
+	QStringList types = queryTypes();
+	QStringList::ConstIterator itEnd = types.end();
+	for (QStringList::ConstIterator it=types.begin(); it!=itEnd; ++it) {
+		Query* q = m_queries.find(queryKey(*it,domain));
+		if (q && !q->isFinished()) return false;
+	}
+	return true;
+}
+
 ServiceBrowser::ServiceBrowser(const QString& type,DomainBrowser* domains,bool autoResolve)
 {
 	if (domains) init(type,domains,autoResolve ? AutoResolve : 0);
@@ -63,10 +314,13 @@ ServiceBrowser::ServiceBrowser(const QStringList& types,DomainBrowser* domains,i
 void ServiceBrowser::init(const QStringList& type,DomainBrowser* domains,int flags)
 {
 	d = new ServiceBrowserPrivate();
-	d->resolvers.setAutoDelete(true);
+	d->m_browser = this;
 	d->m_types=type;
 	d->m_flags=flags;
 	d->m_domains = domains;
+	connect(&d->m_batchTimer,SIGNAL(timeout()),this,SLOT(flushBatch()));
+	connect(&d->m_sweepTimer,SIGNAL(timeout()),this,SLOT(sweep()));
+	connect(&d->m_dampingTimer,SIGNAL(timeout()),this,SLOT(reapDying()));
 	connect(d->m_domains,SIGNAL(domainAdded(const QString& )),this,SLOT(addDomain(const QString& )));
 	connect(d->m_domains,SIGNAL(domainRemoved(const QString& )),this,
 		SLOT(removeDomain(const QString& )));
@@ -91,6 +345,8 @@ const ServiceBrowser::State ServiceBrowser::isAvailable()
 }
 ServiceBrowser::~ ServiceBrowser()
 {
+	ResolveScheduler::self().cancel(this);
+	if (d->m_flags & PersistentCache) saveCache();
 	if (d->m_flags & AutoDelete) delete d->m_domains;
 	delete d;
 }
@@ -104,25 +360,89 @@ void ServiceBrowser::serviceResolved(bool success)
 {
 	QObject* sender_obj = const_cast<QObject*>(sender());
 	RemoteService* svr = static_cast<RemoteService*>(sender_obj);
-	disconnect(svr,SIGNAL(resolved(bool)),this,SLOT(serviceResolved(bool)));
-	QValueList<RemoteService::Ptr>::Iterator it = d->m_duringResolve.begin();
-	QValueList<RemoteService::Ptr>::Iterator itEnd = d->m_duringResolve.end();
-	while ( it!= itEnd && svr!= (*it)) ++it;
-	if (it != itEnd) {
-		if (success) {
-		  	d->m_services+=(*it);
-			emit serviceAdded(svr);
+	QString key = serviceKey(svr->serviceName(), svr->type(), svr->domain());
+	ServiceBrowserPrivate::Entry* e = d->m_index.find(key);
+	if (e && e->m_live.data()==svr) {
+		refreshed(key, success);
+		return;
+	}
+	if (!e || e->m_service.data()!=svr) {
+		disconnect(svr,SIGNAL(resolved(bool)),this,SLOT(serviceResolved(bool)));
+		return;
+	}
+	if (success) e->m_lastSeen = timestamp();
+	// listed service stays connected, so new resolves are journaled
+	if (e->m_listed) {
+		bool verifying = e->m_verifying;
+		e->m_verifying = false;
+		if (!success) {
+			// service did not answer after reaching maximum age
+			if (verifying) forget(key);
+			return;
 		}
-		d->m_duringResolve.remove(it);
-		queryFinished();
+		// TXT may not match filter anymore. Repeated resolves of unchanged service,
+		// e.g. by sweep(), are not changes
+		if (!d->m_filter.matchesText(svr->textData())) reject(key);
+			else if (e->remember(svr)) d->journal(ServiceChange::Updated, e, key);
+		return;
 	}
+	if (e->m_rejected) {
+		// TXT changed or service was resolved by somebody else
+		if (success && d->m_filter.matchesText(svr->textData())) {
+			e->m_rejected = false;
+			d->list(e);
+			report(ServiceChange::Added, key);
+		}
+		return;
+	}
+	if (success) {
+		// shared service may have been resolved by somebody else while queued
+		ResolveScheduler::self().cancel(svr, this);
+		d->m_resolving--;
+		if (d->m_filter.matchesText(svr->textData())) {
+			d->list(e);
+			report(ServiceChange::Added, key);
+		} else e->m_rejected = true;
+	} else forget(key);
+	queryCacheExhausted();
+	queryFinished();
+}
+
+void ServiceBrowser::setInterfaces(const QValueList<int>& interfaces)
+{
+	d->m_interfaces = interfaces;
+}
+
+void ServiceBrowser::setProtocol(RemoteService::Protocol protocol)
+{
+	d->m_protocol = protocol;
+}
+
+void ServiceBrowser::setSubtypes(const QStringList& subtypes)
+{
+	if (!d->m_running) d->m_subtypes = subtypes;
+}
+
+void ServiceBrowser::setFilter(const ServiceFilter& filter)
+{
+	if (!d->m_running) d->m_filter = filter;
+}
+
+void ServiceBrowser::setResolvePriority(ResolveScheduler::Priority priority)
+{
+	d->m_resolvePriority = priority;
 }
 
 void ServiceBrowser::startBrowse()
 {
 	if (d->m_running) return;
 	d->m_running=true;
-	if (isAvailable()!=Working) return;
+	// do not wait for connection, queries are queued until client is running. Without
+	// daemon there is nothing to wait for
+	if (Responder::self().failed()) {
+		emit finished();
+		return;
+	}
 	if (d->m_domains->isRunning()) {
 		QStringList::const_iterator itEnd  = d->m_domains->domains().end();
 		for ( QStringList::const_iterator it = d->m_domains->domains().begin(); it != itEnd; ++it )
@@ -130,57 +450,342 @@ void ServiceBrowser::startBrowse()
 	} else d->m_domains->startBrowse();
 }
 
-void ServiceBrowser::gotNewService(RemoteService::Ptr svr)
+void ServiceBrowser::gotNewRecord(const ServiceRecord& record)
+{
+	if (!d->m_filter.matchesName(record.serviceName())) return;
+	QString key = serviceKey(record.serviceName(), record.type(), record.domain());
+	ServiceBrowserPrivate::Entry* e = d->m_index.find(key);
+	if (e) {
+		// service from disk cache is still there or came back before it was removed
+		if (e->m_stale) refresh(key, record);
+		e->m_stale = false;
+		e->m_seenBy++;
+		e->m_lastSeen = timestamp();
+		if (e->m_removing) {
+			e->m_removing = false;
+			countFlap();
+		}
+		return;
+	}
+	e = new ServiceBrowserPrivate::Entry;
+	e->m_record = record;
+	e->m_listed = false;
+	e->m_stale = false;
+	e->m_queryType = static_cast<const Query*>(sender())->type();
+	e->m_seenBy = 1;
+	d->insert(e, key);
+	if (d->mustResolve()) {
+		d->m_resolving++;
+		ResolveScheduler::self().enqueue(d->service(e), this, d->m_resolvePriority);
+	} else	{
+		d->list(e);
+		report(ServiceChange::Added, key);
+	}
+}
+
+void ServiceBrowser::gotRemoveRecord(const ServiceRecord& record)
+{
+	QString key = serviceKey(record.serviceName(), record.type(), record.domain());
+	ServiceBrowserPrivate::Entry* e = d->m_index.find(key);
+	if (!e) return;
+	// query for another subtype still sees it
+	if (e->m_seenBy && --e->m_seenBy) return;
+	// services being resolved are dropped at once, there is nothing to keep
+	if (!d->m_dampingInterval || !e->m_listed) {
+		forget(key);
+		return;
+	}
+	if (e->m_removing) return;
+	e->m_removing = true;
+	e->m_removedAt = timestamp();
+	d->m_dying.append(key);
+	if (!d->m_dampingTimer.isActive()) d->m_dampingTimer.start(d->m_dampingInterval, true);
+}
+
+void ServiceBrowser::reapDying()
+{
+	uint now = timestamp();
+	while (!d->m_dying.isEmpty()) {
+		QString key = d->m_dying.first();
+		ServiceBrowserPrivate::Entry* e = d->m_index.find(key);
+		// service came back or was forgotten already
+		if (!e || !e->m_removing) {
+			d->m_dying.remove(d->m_dying.begin());
+			continue;
+		}
+		int left = d->m_dampingInterval-(int)(now-e->m_removedAt);
+		if (left>0) {
+			d->m_dampingTimer.start(left, true);
+			return;
+		}
+		d->m_dying.remove(d->m_dying.begin());
+		forget(key);
+	}
+}
+
+void ServiceBrowser::setDampingInterval(int interval)
+{
+	d->m_dampingInterval = QMAX(interval,0);
+	// pending removals are reported with new interval
+	if (!d->m_dying.isEmpty()) reapDying();
+}
+
+void ServiceBrowser::forget(const QString& key)
+{
+	ServiceBrowserPrivate::Entry* e = d->m_index.find(key);
+	if (!e) return;
+	// reported while it is still listed
+	if (e->m_listed) report(ServiceChange::Removed, key);
+	e = d->m_index.take(key);
+	if (!e) return;
+	d->removeFromGroup(e, key);
+	if (e->m_service) disconnect(e->m_service,SIGNAL(resolved(bool)),this,SLOT(serviceResolved(bool)));
+	if (e->m_live) {
+		disconnect(e->m_live,SIGNAL(resolved(bool)),this,SLOT(serviceResolved(bool)));
+		ResolveScheduler::self().cancel(e->m_live, this);
+	}
+	if (e->m_listed) {
+		if (e->m_verifying) ResolveScheduler::self().cancel(e->m_service, this);
+		d->unlist(e);
+	} else if (!e->m_rejected) {
+		ResolveScheduler::self().cancel(e->m_service, this);
+		d->m_resolving--;
+	}
+	delete e;
+}
+
+void ServiceBrowser::reject(const QString& key)
+{
+	ServiceBrowserPrivate::Entry* e = d->m_index.find(key);
+	report(ServiceChange::Removed, key);
+	d->unlist(e);
+	e->m_listed = false;
+	e->m_rejected = true;
+	e->m_verifying = false;
+}
+
+void ServiceBrowser::loadCache(const QString& type, const QString& domain)
+{
+	QValueList<RemoteService::Ptr> services = BrowseCache::load(type, domain);
+	QValueList<RemoteService::Ptr>::ConstIterator itEnd = services.end();
+	for (QValueList<RemoteService::Ptr>::ConstIterator it = services.begin(); it!=itEnd; ++it) {
+		RemoteService::Ptr svr = *it;
+		if (!d->m_filter.matchesName(svr->serviceName())) continue;
+		// resolved services are expected
+		if (d->mustResolve() && (!svr->isResolved() || !d->m_filter.matchesText(svr->textData())))
+			continue;
+		QString key = serviceKey(svr->serviceName(), svr->type(), svr->domain());
+		if (d->m_index.find(key)) continue;
+		ServiceBrowserPrivate::Entry* e = new ServiceBrowserPrivate::Entry;
+		e->m_record = ServiceRecord(svr->serviceName(), svr->type(), svr->domain(),
+			svr->interfaceIndex(), svr->protocol(), true);
+		e->m_service = svr;
+		e->m_stale = true;
+		e->m_queryType = type;
+		d->insert(e, key);
+		connect(svr,SIGNAL(resolved(bool )),this,SLOT(serviceResolved(bool )));
+		d->list(e);
+		report(ServiceChange::Added, key);
+	}
+}
+
+void ServiceBrowser::refresh(const QString& key, const ServiceRecord& record)
+{
+	ServiceBrowserPrivate::Entry* e = d->m_index.find(key);
+	e->m_record = record;
+	// nothing to check, live service simply replaces cached one
+	if (!e->m_service->isResolved()) {
+		disconnect(e->m_service,SIGNAL(resolved(bool)),this,SLOT(serviceResolved(bool)));
+		e->m_service = 0;
+		d->m_listChanged = true;
+		return;
+	}
+	// cached data stays listed until live service is resolved
+	e->m_live = record.remoteService();
+	connect(e->m_live,SIGNAL(resolved(bool )),this,SLOT(serviceResolved(bool )));
+	ResolveScheduler::self().enqueue(e->m_live, this, d->m_resolvePriority);
+}
+
+void ServiceBrowser::refreshed(const QString& key, bool success)
+{
+	ServiceBrowserPrivate::Entry* e = d->m_index.find(key);
+	RemoteService::Ptr live = e->m_live;
+	e->m_live = 0;
+	// it was announced a moment ago, so cached data are better than nothing
+	if (!success) {
+		disconnect(live,SIGNAL(resolved(bool)),this,SLOT(serviceResolved(bool)));
+		return;
+	}
+	e->m_lastSeen = timestamp();
+	RemoteService::Ptr cached = e->m_service;
+	disconnect(cached,SIGNAL(resolved(bool)),this,SLOT(serviceResolved(bool)));
+	e->m_service = live;
+	d->m_listChanged = true;
+	if (!d->m_filter.matchesText(live->textData())) reject(key);
+		else if (e->remember(live)) d->journal(ServiceChange::Updated, e, key);
+}
+
+void ServiceBrowser::saveCache()
 {
-	if (findDuplicate(svr)==(d->m_services.end()))  {
-		if (d->m_flags & AutoResolve) {
-			connect(svr,SIGNAL(resolved(bool )),this,SLOT(serviceResolved(bool )));
-			d->m_duringResolve+=svr;
-			svr->resolveAsync();
-		} else	{
-			d->m_services+=svr;
-			emit serviceAdded(svr);
+	QDictIterator<Query> it(d->m_queries);
+	for ( ; it.current(); ++it) {
+		Query* q = it.current();
+		QValueList<RemoteService::Ptr> services;
+		QDict<ServiceBrowserPrivate::Entry>* group = d->group(q->type(), q->domain());
+		if (group) {
+			QDictIterator<ServiceBrowserPrivate::Entry> entry(*group);
+			for ( ; entry.current(); ++entry) {
+				ServiceBrowserPrivate::Entry* e = entry.current();
+				// services from disk cache not seen again are saved only if
+				// there was chance to see them
+				if (!e->m_listed || (e->m_stale && !d->isFinished(q->domain()))) continue;
+				// no need to keep service created just for saving
+				services.append(e->m_service ? e->m_service : e->m_record.remoteService());
+			}
 		}
+		BrowseCache::save(q->type(), q->domain(), services);
 	}
 }
 
-void ServiceBrowser::gotRemoveService(RemoteService::Ptr svr)
+void ServiceBrowser::evictStale()
 {
-	QValueList<RemoteService::Ptr>::Iterator it = findDuplicate(svr);
-	if (it!=(d->m_services.end())) {
-		emit serviceRemoved(*it);
-		d->m_services.remove(it);
+	const Query* query = static_cast<const Query*>(sender());
+	QString domain = domainKey(query->domain());
+	// wait for all types in the domain
+	if (!d->isFinished(domain)) return;
+	QStringList types = d->queryTypes();
+	QStringList::ConstIterator itEnd = types.end();
+	QStringList stale;
+	for (QStringList::ConstIterator it=types.begin(); it!=itEnd; ++it) {
+		QDict<ServiceBrowserPrivate::Entry>* group = d->group(*it, domain);
+		if (!group) continue;
+		QDictIterator<ServiceBrowserPrivate::Entry> entry(*group);
+		for ( ; entry.current(); ++entry) if (entry.current()->m_stale) stale.append(entry.currentKey());
 	}
+	itEnd = stale.end();
+	for (QStringList::ConstIterator it=stale.begin(); it!=itEnd; ++it) forget(*it);
 }
 
+void ServiceBrowser::report(ServiceChange::Type type, const QString& key)
+{
+	ServiceBrowserPrivate::Entry* e = d->m_index.find(key);
+	d->journal(type, e, key);
+	if (receivers(SIGNAL(servicesAdded(const QValueList<DNSSD::RemoteService::Ptr>&))) ||
+	    receivers(SIGNAL(servicesRemoved(const QValueList<DNSSD::RemoteService::Ptr>&)))) {
+		// batch has to be emitted before batch of another kind is started
+		if (!d->m_batch.isEmpty() && d->m_batchType!=type) flushBatch();
+		if (d->m_batch.isEmpty()) d->m_batchTimer.start(d->m_batchInterval,true);
+		d->m_batchType = type;
+		d->m_batch.append(d->service(e));
+	}
+	// RemoteService is created only if somebody wants it
+	if (type==ServiceChange::Added) {
+		if (receivers(SIGNAL(serviceAdded(DNSSD::RemoteService::Ptr))))
+			emit serviceAdded(d->service(e));
+	} else if (receivers(SIGNAL(serviceRemoved(DNSSD::RemoteService::Ptr))))
+			emit serviceRemoved(d->service(e));
+}
+
+void ServiceBrowser::flushBatch()
+{
+	d->m_batchTimer.stop();
+	if (d->m_batch.isEmpty()) return;
+	// slots may add more services
+	QValueList<RemoteService::Ptr> batch = d->m_batch;
+	d->m_batch.clear();
+	if (d->m_batchType==ServiceChange::Added) emit servicesAdded(batch);
+		else emit servicesRemoved(batch);
+}
+
+void ServiceBrowser::setBatchInterval(int interval)
+{
+	d->m_batchInterval = QMAX(interval,0);
+}
+
+void ServiceBrowser::setMaxAge(int seconds)
+{
+	d->m_maxAge = QMAX(seconds,0);
+	if (!d->m_maxAge) {
+		d->m_sweepTimer.stop();
+		return;
+	}
+	// entry is checked at most quarter of maximum age late
+	d->m_sweepTimer.start(QMAX(d->m_maxAge*250,1000));
+}
+
+QDateTime ServiceBrowser::firstSeen(const RemoteService::Ptr& service) const
+{
+	const ServiceBrowserPrivate::Entry* e = d->m_index.find(serviceKey(service->serviceName(),
+		service->type(), service->domain()));
+	if (!e) return QDateTime();
+	return QDateTime::currentDateTime().addSecs(-(int)((timestamp()-e->m_firstSeen)/1000));
+}
+
+QDateTime ServiceBrowser::lastSeen(const RemoteService::Ptr& service) const
+{
+	const ServiceBrowserPrivate::Entry* e = d->m_index.find(serviceKey(service->serviceName(),
+		service->type(), service->domain()));
+	if (!e) return QDateTime();
+	return QDateTime::currentDateTime().addSecs(-(int)((timestamp()-e->m_lastSeen)/1000));
+}
+
+void ServiceBrowser::sweep()
+{
+	uint now = timestamp();
+	uint maxAge = d->m_maxAge*1000;
+	QDictIterator<ServiceBrowserPrivate::Entry> it(d->m_index);
+	for ( ; it.current(); ++it) {
+		ServiceBrowserPrivate::Entry* e = it.current();
+		// services being resolved or verified will have answer soon
+		if (!e->m_listed || e->m_verifying || e->m_live || e->m_removing || now-e->m_lastSeen<maxAge)
+			continue;
+		e->m_verifying = true;
+		// cached answer would not prove anything
+		ResolveScheduler::self().enqueue(d->service(e), this, ResolveScheduler::Low, true);
+	}
+}
 
 void ServiceBrowser::removeDomain(const QString& domain)
 {
-	while (d->resolvers[domain]) d->resolvers.remove(domain);
-	QValueList<RemoteService::Ptr>::Iterator it = d->m_services.begin();
-	while (it!=d->m_services.end()) 
-		// use section to skip possible trailing dot
-		if ((*it)->domain().section('.',0) == domain.section('.',0)) {
-			emit serviceRemoved(*it);
-			it = d->m_services.remove(it);
-		} else ++it;
+	QStringList types = d->queryTypes();
+	QStringList::ConstIterator itEnd = types.end();
+	// forget() deletes group with its last entry
+	QStringList keys;
+	for (QStringList::ConstIterator it=types.begin(); it!=itEnd; ++it) {
+		d->m_queries.remove(queryKey(*it,domain));
+		QDict<ServiceBrowserPrivate::Entry>* group = d->group(*it, domain);
+		if (!group) continue;
+		QDictIterator<ServiceBrowserPrivate::Entry> entry(*group);
+		for ( ; entry.current(); ++entry) keys.append(entry.currentKey());
+	}
+	itEnd = keys.end();
+	for (QStringList::ConstIterator it=keys.begin(); it!=itEnd; ++it) forget(*it);
 }
 
 void ServiceBrowser::addDomain(const QString& domain)
 {
 	if (!d->m_running) return;
-	if (!(d->resolvers[domain])) {
-		QStringList::ConstIterator itEnd = d->m_types.end();
-		for (QStringList::ConstIterator it=d->m_types.begin(); it!=itEnd; ++it) {
-			Query* b = new Query((*it),domain);
-			connect(b,SIGNAL(serviceAdded(DNSSD::RemoteService::Ptr)),this,
-				SLOT(gotNewService(DNSSD::RemoteService::Ptr)));
-			connect(b,SIGNAL(serviceRemoved(DNSSD::RemoteService::Ptr )),this,
-				SLOT(gotRemoveService(DNSSD::RemoteService::Ptr)));
-			connect(b,SIGNAL(finished()),this,SLOT(queryFinished()));
-			b->startQuery();
-			d->resolvers.insert(domain,b);
+	QStringList types = d->queryTypes();
+	QStringList::ConstIterator itEnd = types.end();
+	for (QStringList::ConstIterator it=types.begin(); it!=itEnd; ++it) {
+		if (d->m_queries.find(queryKey(*it,domain))) continue;
+		Query* b = new Query((*it),domain);
+		b->setInterfaces(d->m_interfaces);
+		b->setProtocol(d->m_protocol);
+		b->setCacheOnly(d->m_flags & CacheOnly);
+		connect(b,SIGNAL(recordAdded(const DNSSD::ServiceRecord&)),this,
+			SLOT(gotNewRecord(const DNSSD::ServiceRecord&)));
+		connect(b,SIGNAL(recordRemoved(const DNSSD::ServiceRecord&)),this,
+			SLOT(gotRemoveRecord(const DNSSD::ServiceRecord&)));
+		connect(b,SIGNAL(cacheExhausted()),this,SLOT(queryCacheExhausted()));
+		if (d->m_flags & PersistentCache) {
+			connect(b,SIGNAL(finished()),this,SLOT(evictStale()));
+			loadCache(*it,domain);
 		}
+		connect(b,SIGNAL(finished()),this,SLOT(queryFinished()));
+		connect(b,SIGNAL(failed()),this,SLOT(queryFailed()));
+		b->startQuery();
+		d->m_queries.insert(queryKey(*it,domain),b);
 	}
 }
 
@@ -189,32 +794,113 @@ void ServiceBrowser::queryFinished()
 	if (allFinished()) emit finished();
 }
 
+void ServiceBrowser::queryCacheExhausted()
+{
+	if (d->m_cacheExhausted || d->m_resolving) return;
+	QDictIterator<Query> it(d->m_queries);
+	for ( ; it.current(); ++it) if (!(*it)->isCacheExhausted()) return;
+	d->m_cacheExhausted = true;
+	emit cacheExhausted();
+}
+
+void ServiceBrowser::queryFailed()
+{
+	const Query* query = static_cast<const Query*>(sender());
+	emit failed(query->domain());
+}
+
 bool ServiceBrowser::allFinished()
 {
-	if  (d->m_duringResolve.count()) return false;
+	if  (d->m_resolving) return false;
 	bool all = true;
-	QDictIterator<Query> it(d->resolvers);
+	QDictIterator<Query> it(d->m_queries);
 	for ( ; it.current(); ++it) all&=(*it)->isFinished();
 	return all;
 }
 
 const QValueList<RemoteService::Ptr>& ServiceBrowser::services() const
 {
+	if (d->m_listChanged) {
+		d->m_services.clear();
+		QValueList<ServiceBrowserPrivate::Entry*>::ConstIterator itEnd = d->m_listed.end();
+		for (QValueList<ServiceBrowserPrivate::Entry*>::ConstIterator it = d->m_listed.begin(); it!=itEnd; ++it)
+			d->m_services.append(d->service(*it));
+		d->m_listChanged = false;
+	}
 	return d->m_services;
 }
 
-void ServiceBrowser::virtual_hook(int, void*)
-{}
+uint ServiceBrowser::generation() const
+{
+	return d->m_generation;
+}
+
+// all changes of one service found by changesSince()
+struct MergedChange
+{
+	ServiceChange::Type m_first;
+	ServiceChange::Type m_last;
+	RemoteService::Ptr m_service;
+};
+
+bool ServiceBrowser::changesSince(uint generation, QValueList<ServiceChange>& changes) const
+{
+	changes.clear();
+	if (generation<d->m_dropped || generation>d->m_generation) {
+		// journal does not reach that far, send everything
+		QValueList<ServiceBrowserPrivate::Entry*>::ConstIterator itEnd = d->m_listed.end();
+		for (QValueList<ServiceBrowserPrivate::Entry*>::ConstIterator it = d->m_listed.begin(); it!=itEnd; ++it)
+			changes.append(ServiceChange(ServiceChange::Added,d->service(*it)));
+		return false;
+	}
+	// look for first change after generation from the newest one
+	QValueList<ServiceBrowserPrivate::Change>::ConstIterator it = d->m_journal.end();
+	QValueList<ServiceBrowserPrivate::Change>::ConstIterator itBegin = d->m_journal.begin();
+	while (it!=itBegin) {
+		--it;
+		if ((*it).m_generation<=generation) {
+			++it;
+			break;
+		}
+	}
+	// merge changes of each service, keeping order of first change
+	QPtrList<MergedChange> merged;
+	merged.setAutoDelete(true);
+	QDict<MergedChange> byKey(251);
+	QValueList<ServiceBrowserPrivate::Change>::ConstIterator itEnd = d->m_journal.end();
+	for ( ; it!=itEnd; ++it) {
+		MergedChange* m = byKey.find((*it).m_key);
+		if (!m) {
+			m = new MergedChange;
+			m->m_first = (*it).m_type;
+			merged.append(m);
+			byKey.insert((*it).m_key, m);
+		}
+		m->m_last = (*it).m_type;
+		// shared service of the record is the same object, if it still exists
+		m->m_service = ((*it).m_service) ? (*it).m_service : (*it).m_record.remoteService();
+	}
+	for (MergedChange* m = merged.first(); m; m = merged.next()) {
+		if (m->m_last==ServiceChange::Removed) {
+			// service added and removed again is not reported
+			if (m->m_first!=ServiceChange::Added)
+				changes.append(ServiceChange(ServiceChange::Removed,m->m_service));
+		} else changes.append(ServiceChange((m->m_first==ServiceChange::Added) ? ServiceChange::Added :
+			ServiceChange::Updated, m->m_service));
+	}
+	return true;
+}
 
-QValueList<RemoteService::Ptr>::Iterator ServiceBrowser::findDuplicate(RemoteService::Ptr src)
+void ServiceBrowser::setJournalSize(uint size)
 {
-	QValueList<RemoteService::Ptr>::Iterator itEnd = d->m_services.end();
-	for (QValueList<RemoteService::Ptr>::Iterator it = d->m_services.begin(); it!=itEnd; ++it) 
-		if ((src->type()==(*it)->type()) && (src->serviceName()==(*it)->serviceName()) &&
-				   (src->domain() == (*it)->domain())) return it;
-	return itEnd;
+	d->m_journalSize = size;
+	d->trimJournal();
 }
 
+void ServiceBrowser::virtual_hook(int, void*)
+{}
+
+
 
 }
 
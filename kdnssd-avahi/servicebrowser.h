@@ -23,7 +23,12 @@
 
 #include <qobject.h>
 #include <qdict.h>
+#include <qdatetime.h>
 #include <dnssd/remoteservice.h>
+#include <dnssd/servicerecord.h>
+#include <dnssd/resolvescheduler.h>
+#include <dnssd/servicechange.h>
+#include <dnssd/servicefilter.h>
 
 
 class QStringList;
@@ -59,11 +64,21 @@ public:
 	@li AutoDelete -  DomainBrowser object passes in constructor should be deleted when ServiceBrowser is deleted
 	@li AutoResolve - after disovering new service it will be resolved and then
 	reported with serviceAdded() signal. It raises network usage by resolving all services,
-	so use it only when necessary.
+	so use it only when necessary. Services are resolved through ResolveScheduler, so only
+	limited number of them is resolved at once.
+	@li CacheOnly - report only services that daemon already has in its cache and stop
+	browsing when they are all reported. finished() is emitted right after cacheExhausted()
+	and no further changes are reported. It is meant for quickly filling lists, see
+	RemoteService::isCached()
+	@li PersistentCache - services found are saved on disk when browser is deleted. Next
+	time they are reported as soon as browsing of their domain starts, marked as cached.
+	Those not found again are removed when browsing of the domain finishes.
 	 */
 	enum Flags {
 	AutoDelete =1,
-	AutoResolve = 2
+	AutoResolve = 2,
+	CacheOnly = 4,
+	PersistentCache = 8
 	};
 
 	/**
@@ -122,6 +137,102 @@ public:
 	 */
 	const QValueList<RemoteService::Ptr>& services() const;
 
+	/**
+	Returns generation of services() list. It grows by one with every change of the
+	list and starts at 0.
+	 */
+	uint generation() const;
+
+	/**
+	Fills changes with everything that happened to services() list since given
+	generation. Changes of one service are merged, so each service appears there at most
+	once, and service added and removed again is not reported at all.
+
+	Only limited number of last changes is kept. If they do not reach back to given
+	generation, changes are filled with all current services as Added and false is
+	returned, so previously stored list should be dropped first.
+	\code
+	QValueList<DNSSD::ServiceChange> changes;
+	if (!browser->changesSince(m_generation, changes)) m_list.clear();
+	m_generation = browser->generation();
+	\endcode
+	 */
+	bool changesSince(uint generation, QValueList<ServiceChange>& changes) const;
+
+	/**
+	Sets number of changes kept for changesSince(). Default is 1000
+	 */
+	void setJournalSize(uint size);
+
+	/**
+	Restricts browsing to given network interfaces. Empty list (default) means all. Has
+	to be called before startBrowse().
+	@param interfaces Interface indexes as returned by if_nametoindex()
+	 */
+	void setInterfaces(const QValueList<int>& interfaces);
+
+	/**
+	Restricts browsing to IPv4 or IPv6. Has to be called before startBrowse().
+	 */
+	void setProtocol(RemoteService::Protocol protocol);
+
+	/**
+	Restricts browsing to services registered with at least one of given subtypes, for
+	example "_printer". Avahi browses for subtypes directly, so other services of the
+	same type are not even sent over network. Has to be called before startBrowse().
+	@see ServiceBase::subtypeName()
+	 */
+	void setSubtypes(const QStringList& subtypes);
+
+	/**
+	Sets how long (in milliseconds) changes are collected before servicesAdded() or
+	servicesRemoved() is emitted. Default 0 means once per event loop pass.
+	 */
+	void setBatchInterval(int interval);
+
+	/**
+	Sets maximum age of services in seconds. Service that has not been seen for that
+	long is resolved again and if it does not answer, it is removed as if it was no longer
+	announced. It catches hosts that dropped off network without saying goodbye. Service is
+	seen when it is found, announced again or successfully resolved. Default 0 disables it.
+	 */
+	void setMaxAge(int seconds);
+
+	/**
+	Sets how long (in milliseconds) removal of service is delayed. If service is
+	announced again within this interval, neither removal nor new addition is reported and
+	its resolved data are kept. It hides laptops and printers that briefly drop off network.
+	Default 0 reports removals immediately.
+	@see Statistics::flaps()
+	 */
+	void setDampingInterval(int interval);
+
+	/**
+	Returns time when given service was found by this browser. Invalid QDateTime is
+	returned for unknown services.
+	 */
+	QDateTime firstSeen(const RemoteService::Ptr& service) const;
+
+	/**
+	Returns time when given service was last seen by this browser. Invalid QDateTime is
+	returned for unknown services.
+	@see setMaxAge()
+	 */
+	QDateTime lastSeen(const RemoteService::Ptr& service) const;
+
+	/**
+	Sets filter for services. Services not matching it are not reported and no
+	RemoteService objects are created for those with non-matching names. Has to be
+	called before startBrowse().
+	 */
+	void setFilter(const ServiceFilter& filter);
+
+	/**
+	Sets priority of resolves started by AutoResolve flag. Default is
+	ResolveScheduler::Normal. Affects only services found after this call.
+	 */
+	void setResolvePriority(ResolveScheduler::Priority priority);
+
 	/**
 	Starts browsing for services.
 	To stop it just destroy the object.
@@ -142,7 +253,9 @@ public:
 	static const QString AllServices;
 
 	/**
-	Checks availability of DNS-SD services (this also covers publishing).
+	Checks availability of DNS-SD services (this also covers publishing). It does not
+	block: while connection to daemon is still being established, services are reported
+	as Working.
 
 	If you use this function to report an error to the user, below is a suggestion
 	on how to word the errors:
@@ -195,6 +308,33 @@ signals:
 	 */
 	void finished();
 
+	/**
+	Emitted once, when services daemon had in its cache has been reported for all
+	domains browsed so far. Unless CacheOnly flag is set, browsing continues and
+	finished() is emitted later.
+	 */
+	void cacheExhausted();
+
+	/**
+	Emitted when browsing of given domain failed. Services found there so far are kept
+	and the domain counts as finished.
+	 */
+	void failed(const QString& domain);
+
+	/**
+	Emitted with services that were added during one batching interval, in addition to
+	serviceAdded() for each of them. Use it to update views in bulk.
+	@see setBatchInterval()
+	 */
+	void servicesAdded(const QValueList<DNSSD::RemoteService::Ptr>&);
+
+	/**
+	Emitted with services that were removed during one batching interval, in addition
+	to serviceRemoved() for each of them. Additions and removals are reported in the
+	order they happened, so consecutive changes of one kind form one batch.
+	 */
+	void servicesRemoved(const QValueList<DNSSD::RemoteService::Ptr>&);
+
 public slots:
 	/**
 	Remove one domain from list of domains to browse
@@ -213,12 +353,28 @@ private:
 
 	bool allFinished();
 	void init(const QStringList&, DomainBrowser*, int);
-	QValueList<RemoteService::Ptr>::Iterator findDuplicate(RemoteService::Ptr src);
+	// removes service from all indexes, reporting it if it was listed
+	void forget(const QString& key);
+	// unlists service whose TXT does not match filter, it is checked again on next resolve
+	void reject(const QString& key);
+	void loadCache(const QString& type, const QString& domain);
+	void saveCache();
+	// replaces service loaded from disk cache by live one
+	void refresh(const QString& key, const ServiceRecord& record);
+	void refreshed(const QString& key, bool success);
+	// journals change and emits signals for it
+	void report(ServiceChange::Type type, const QString& key);
 private slots:
 	void serviceResolved(bool success);
-	void gotNewService(DNSSD::RemoteService::Ptr);
-	void gotRemoveService(DNSSD::RemoteService::Ptr);
+	void gotNewRecord(const DNSSD::ServiceRecord&);
+	void gotRemoveRecord(const DNSSD::ServiceRecord&);
 	void queryFinished();
+	void queryCacheExhausted();
+	void queryFailed();
+	void flushBatch();
+	void evictStale();
+	void sweep();
+	void reapDying();
 
 };
 
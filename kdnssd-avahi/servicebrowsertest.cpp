@@ -0,0 +1,115 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+Checks merging of journal by ServiceBrowser::changesSince(). Browser is fed by query
+that is never started, so no daemon is needed.
+*/
+
+#include <stdio.h>
+#include <qapplication.h>
+#include <kinstance.h>
+#include "servicebrowser.h"
+#include "servicerecord.h"
+#include "query.h"
+
+using namespace DNSSD;
+
+static int failures = 0;
+
+static void check(const char* what, bool ok)
+{
+	printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) failures++;
+}
+
+// reports services to browser the way running query does
+class FakeQuery : public Query
+{
+public:
+	FakeQuery() : Query("_test._tcp", "local.") {}
+	void add(const char* name) { emit recordAdded(record(name)); }
+	void remove(const char* name) { emit recordRemoved(record(name)); }
+private:
+	static ServiceRecord record(const char* name)
+	{
+		return ServiceRecord(name, "_test._tcp", "local.");
+	}
+};
+
+static bool isChange(const ServiceChange& c, ServiceChange::Type type, const char* name)
+{
+	return c.type()==type && c.service()->serviceName()==name;
+}
+
+int main(int argc, char** argv)
+{
+	KInstance instance("servicebrowsertest");
+	QApplication app(argc, argv, false);
+	ServiceBrowser browser("_test._tcp", "local.");
+	FakeQuery query;
+	QObject::connect(&query, SIGNAL(recordAdded(const DNSSD::ServiceRecord&)), &browser,
+		SLOT(gotNewRecord(const DNSSD::ServiceRecord&)));
+	QObject::connect(&query, SIGNAL(recordRemoved(const DNSSD::ServiceRecord&)), &browser,
+		SLOT(gotRemoveRecord(const DNSSD::ServiceRecord&)));
+	QValueList<ServiceChange> changes;
+
+	uint start = browser.generation();
+	query.add("a");
+	query.add("b");
+	bool ok = browser.changesSince(start, changes);
+	check("additions in order", ok && changes.count()==2 &&
+		isChange(changes[0], ServiceChange::Added, "a") && isChange(changes[1], ServiceChange::Added, "b"));
+
+	uint g = browser.generation();
+	check("nothing new", browser.changesSince(g, changes) && changes.isEmpty());
+
+	query.remove("a");
+	query.add("c");
+	query.remove("c");
+	ok = browser.changesSince(g, changes);
+	check("added and removed again is not reported", ok && changes.count()==1 &&
+		isChange(changes[0], ServiceChange::Removed, "a"));
+
+	query.add("a");
+	ok = browser.changesSince(g, changes);
+	check("removed and added again is updated", ok && changes.count()==1 &&
+		isChange(changes[0], ServiceChange::Updated, "a"));
+
+	ok = browser.changesSince(start, changes);
+	check("merged from the beginning", ok && changes.count()==2 &&
+		isChange(changes[0], ServiceChange::Added, "a") && isChange(changes[1], ServiceChange::Added, "b"));
+
+	check("generation from future gives snapshot", !browser.changesSince(browser.generation()+1, changes) &&
+		changes.count()==2);
+
+	browser.setJournalSize(2);
+	g = browser.generation();
+	query.add("d");
+	query.add("e");
+	query.add("f");
+	ok = browser.changesSince(g, changes);
+	check("dropped journal gives snapshot", !ok && changes.count()==5);
+	g = browser.generation()-2;
+	ok = browser.changesSince(g, changes);
+	check("rest of journal is used", ok && changes.count()==2 &&
+		isChange(changes[0], ServiceChange::Added, "e") && isChange(changes[1], ServiceChange::Added, "f"));
+
+	printf("%s\n", failures ? "FAIL" : "PASS");
+	return failures ? 1 : 0;
+}
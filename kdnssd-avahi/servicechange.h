@@ -0,0 +1,56 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DNSSDSERVICECHANGE_H
+#define DNSSDSERVICECHANGE_H
+
+#include <dnssd/remoteservice.h>
+
+namespace DNSSD
+{
+
+/**
+One entry of change feed returned by ServiceBrowser::changesSince()
+
+@short Change of list of browsed services
+ */
+class KDNSSD_EXPORT ServiceChange
+{
+public:
+	/**
+	@li Added - service was added to list
+	@li Removed - service was removed from list
+	@li Updated - service is still listed but its host, port or TXT data changed or it was
+	replaced by new RemoteService object, so stored copy should be refreshed
+	 */
+	enum Type { Added, Removed, Updated };
+
+	ServiceChange() : m_type(Added) {}
+	ServiceChange(Type type, RemoteService::Ptr service) : m_type(type), m_service(service) {}
+
+	Type type() const { return m_type; }
+	RemoteService::Ptr service() const { return m_service; }
+
+private:
+	Type m_type;
+	RemoteService::Ptr m_service;
+};
+
+}
+
+#endif
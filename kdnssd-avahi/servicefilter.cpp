@@ -0,0 +1,83 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "servicefilter.h"
+
+namespace DNSSD
+{
+
+ServiceFilter::ServiceFilter() : m_prefixCaseSensitive(false), m_hasPattern(false)
+{}
+
+void ServiceFilter::setNamePrefix(const QString& prefix, bool caseSensitive)
+{
+	m_prefix = prefix;
+	m_prefixCaseSensitive = caseSensitive;
+}
+
+void ServiceFilter::setNamePattern(const QRegExp& pattern)
+{
+	m_pattern = pattern;
+	m_hasPattern = !pattern.isEmpty();
+}
+
+void ServiceFilter::requireText(const QString& key, const QString& value, bool caseSensitive)
+{
+	TextCondition c;
+	c.m_key = key;
+	c.m_value = value;
+	c.m_caseSensitive = caseSensitive;
+	m_text.append(c);
+}
+
+bool ServiceFilter::hasTextConditions() const
+{
+	return !m_text.isEmpty();
+}
+
+bool ServiceFilter::matchesName(const QString& name) const
+{
+	if (!m_prefix.isEmpty() && !name.startsWith(m_prefix, m_prefixCaseSensitive)) return false;
+	return !m_hasPattern || m_pattern.search(name)!=-1;
+}
+
+// TXT keys are case-insensitive
+static QMap<QString,QString>::ConstIterator findKey(const QMap<QString,QString>& textData,
+	const QString& key)
+{
+	QMap<QString,QString>::ConstIterator it = textData.find(key);
+	if (it!=textData.end()) return it;
+	QMap<QString,QString>::ConstIterator itEnd = textData.end();
+	for (it = textData.begin(); it!=itEnd; ++it)
+		if (it.key().lower()==key.lower()) return it;
+	return itEnd;
+}
+
+bool ServiceFilter::matchesText(const QMap<QString,QString>& textData) const
+{
+	QValueList<TextCondition>::ConstIterator itEnd = m_text.end();
+	for (QValueList<TextCondition>::ConstIterator it = m_text.begin(); it!=itEnd; ++it) {
+		QMap<QString,QString>::ConstIterator value = findKey(textData, (*it).m_key);
+		if (value==textData.end()) return false;
+		if (!(*it).m_value.isNull() && value.data().find((*it).m_value, 0, (*it).m_caseSensitive)==-1)
+			return false;
+	}
+	return true;
+}
+
+}
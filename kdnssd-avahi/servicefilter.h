@@ -0,0 +1,104 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DNSSDSERVICEFILTER_H
+#define DNSSDSERVICEFILTER_H
+
+#include <qstring.h>
+#include <qregexp.h>
+#include <qmap.h>
+#include <qvaluelist.h>
+#include <kdelibs_export.h>
+
+namespace DNSSD
+{
+
+/**
+Conditions that service has to meet to be reported by ServiceBrowser. All conditions
+have to be met. Name conditions are checked as soon as service is found, before any
+RemoteService object is created. TXT conditions are checked after service is resolved, so
+browser with such filter resolves services even if AutoResolve flag is not set.
+
+Example - printers accepting PDF:
+\code
+DNSSD::ServiceFilter filter;
+filter.requireText("pdl","application/pdf");
+browser->setFilter(filter);
+\endcode
+
+@short Filter for ServiceBrowser
+ */
+class KDNSSD_EXPORT ServiceFilter
+{
+public:
+	/**
+	Creates filter that accepts everything
+	 */
+	ServiceFilter();
+
+	/**
+	Accepts only services whose name starts with prefix
+	 */
+	void setNamePrefix(const QString& prefix, bool caseSensitive=false);
+
+	/**
+	Accepts only services whose name contains match of pattern
+	 */
+	void setNamePattern(const QRegExp& pattern);
+
+	/**
+	Accepts only services with given TXT key. If value is not null, value of the key
+	also has to contain it. Keys are compared case-insensitively. Can be called more times
+	to add more conditions.
+	 */
+	void requireText(const QString& key, const QString& value=QString::null,
+		bool caseSensitive=false);
+
+	/**
+	Returns true if filter has any TXT conditions
+	 */
+	bool hasTextConditions() const;
+
+	/**
+	Checks name conditions
+	 */
+	bool matchesName(const QString& name) const;
+
+	/**
+	Checks TXT conditions
+	 */
+	bool matchesText(const QMap<QString,QString>& textData) const;
+
+private:
+	struct TextCondition
+	{
+		QString m_key;
+		QString m_value;
+		bool m_caseSensitive;
+	};
+
+	QString m_prefix;
+	bool m_prefixCaseSensitive;
+	QRegExp m_pattern;
+	bool m_hasPattern;
+	QValueList<TextCondition> m_text;
+};
+
+}
+
+#endif
@@ -0,0 +1,34 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "servicerecord.h"
+
+namespace DNSSD
+{
+
+RemoteService::Ptr ServiceRecord::remoteService() const
+{
+	return RemoteService::shared(m_name, m_type, m_domain, m_interface, m_protocol, m_cached);
+}
+
+bool ServiceRecord::operator==(const ServiceRecord& other) const
+{
+	return m_name==other.m_name && m_type==other.m_type && m_domain==other.m_domain;
+}
+
+}
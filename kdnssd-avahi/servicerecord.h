@@ -0,0 +1,94 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DNSSDSERVICERECORD_H
+#define DNSSDSERVICERECORD_H
+
+#include <qstring.h>
+#include <dnssd/remoteservice.h>
+
+namespace DNSSD
+{
+
+/**
+Small copyable description of service found by Query: name, type, domain and where it
+was seen. Strings are shared with other records, so copying and storing records is
+cheap. Use remoteService() to get object that can be resolved.
+
+@short Value type describing browsed service
+ */
+class KDNSSD_EXPORT ServiceRecord
+{
+public:
+	/**
+	Creates invalid record
+	 */
+	ServiceRecord() : m_interface(-1), m_protocol(RemoteService::AnyProtocol), m_cached(false) {}
+
+	ServiceRecord(const QString& name, const QString& type, const QString& domain,
+		int interfaceIndex=-1, RemoteService::Protocol protocol=RemoteService::AnyProtocol,
+		bool cached=false)
+		: m_name(name), m_type(type), m_domain(domain), m_interface(interfaceIndex),
+		m_protocol(protocol), m_cached(cached) {}
+
+	/**
+	Returns name of service. It is empty when browsing for service types
+	 */
+	const QString& serviceName() const { return m_name; }
+	const QString& type() const { return m_type; }
+	const QString& domain() const { return m_domain; }
+	/**
+	Returns index of network interface service was found on, -1 if it is not known
+	 */
+	int interfaceIndex() const { return m_interface; }
+	RemoteService::Protocol protocol() const { return m_protocol; }
+	/**
+	Returns true if service was reported from daemon's cache rather than by fresh
+	answer from network
+	 */
+	bool isCached() const { return m_cached; }
+
+	/**
+	Returns false for records created with default constructor
+	 */
+	bool isValid() const { return !m_type.isEmpty(); }
+
+	/**
+	Returns RemoteService for this record. It is shared with everybody else who has
+	the same service, see RemoteService::shared()
+	 */
+	RemoteService::Ptr remoteService() const;
+
+	/**
+	Records are equal if they describe the same service, interface and protocol are ignored.
+	 */
+	bool operator==(const ServiceRecord& other) const;
+	bool operator!=(const ServiceRecord& other) const { return !(*this==other); }
+
+private:
+	QString m_name;
+	QString m_type;
+	QString m_domain;
+	int m_interface;
+	RemoteService::Protocol m_protocol;
+	bool m_cached;
+};
+
+}
+
+#endif
@@ -0,0 +1,138 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <kstaticdeleter.h>
+#include "serviceregistry.h"
+#include "responder.h"
+
+// in ms
+#define RESOLVE_TTL 10000
+// expired results are pruned when there is more of them
+#define MAX_RESOLVED 1000
+
+namespace DNSSD
+{
+
+static KStaticDeleter<ServiceRegistry> registry_sd;
+ServiceRegistry* ServiceRegistry::m_self = 0;
+
+ServiceRegistry& ServiceRegistry::self()
+{
+	if (!m_self) registry_sd.setObject(m_self, new ServiceRegistry);
+	return *m_self;
+}
+
+ServiceRegistry::ServiceRegistry() : m_services(1021), m_ttl(RESOLVE_TTL)
+{
+}
+
+ServiceRegistry::~ServiceRegistry()
+{
+}
+
+// name is length-prefixed, so it may contain anything. Trailing dot of domain is optional
+static QString instanceKey(const QString& name, const QString& type, const QString& domain)
+{
+	QString d = (domain.endsWith(".")) ? domain.left(domain.length()-1) : domain;
+	return QString::number(name.length())+':'+name+type+'@'+d.lower();
+}
+
+QString ServiceRegistry::key(const QString& name, const QString& type, const QString& domain,
+	int interfaceIndex, RemoteService::Protocol protocol)
+{
+	return instanceKey(name,type,domain)+'%'+QString::number(interfaceIndex)+'/'+
+		QString::number((int)protocol);
+}
+
+QString ServiceRegistry::key(const RemoteService* service)
+{
+	return key(service->serviceName(),service->type(),service->domain(),
+		service->interfaceIndex(),service->protocol());
+}
+
+QString ServiceRegistry::resolveKey(const RemoteService* service)
+{
+	return instanceKey(service->serviceName(),service->type(),service->domain());
+}
+
+RemoteService* ServiceRegistry::find(const QString& name, const QString& type,
+	const QString& domain, int interfaceIndex, RemoteService::Protocol protocol) const
+{
+	return m_services.find(key(name,type,domain,interfaceIndex,protocol));
+}
+
+void ServiceRegistry::insert(RemoteService* service)
+{
+	m_services.replace(key(service), service);
+}
+
+void ServiceRegistry::remove(RemoteService* service)
+{
+	QString k = key(service);
+	// another object may have been registered since
+	if (m_services.find(k)==service) m_services.remove(k);
+}
+
+bool ServiceRegistry::lookup(const RemoteService* service, QString& host, unsigned short& port,
+	QMap<QString,QString>& text) const
+{
+	if (m_ttl<=0) return false;
+	QMap<QString,Resolved>::ConstIterator it = m_resolved.find(resolveKey(service));
+	if (it==m_resolved.end() || (int)(timestamp()-(*it).m_time)>=m_ttl) return false;
+	host = (*it).m_host;
+	port = (*it).m_port;
+	text = (*it).m_text;
+	return true;
+}
+
+void ServiceRegistry::store(const RemoteService* service)
+{
+	if (m_ttl<=0) return;
+	if (m_resolved.count()>=MAX_RESOLVED) expire();
+	if (m_resolved.count()>=MAX_RESOLVED) return;
+	Resolved r;
+	r.m_host = service->hostName();
+	r.m_port = service->port();
+	r.m_text = service->textData();
+	r.m_time = timestamp();
+	m_resolved[resolveKey(service)] = r;
+}
+
+void ServiceRegistry::drop(const RemoteService* service)
+{
+	m_resolved.remove(resolveKey(service));
+}
+
+void ServiceRegistry::setTTL(int ttl)
+{
+	m_ttl = ttl;
+	if (m_ttl<=0) m_resolved.clear();
+}
+
+void ServiceRegistry::expire()
+{
+	uint now = timestamp();
+	QMap<QString,Resolved>::Iterator it = m_resolved.begin();
+	while (it!=m_resolved.end()) {
+		QMap<QString,Resolved>::Iterator current = it;
+		++it;
+		if ((int)(now-(*current).m_time)>=m_ttl) m_resolved.remove(current);
+	}
+}
+
+}
@@ -0,0 +1,90 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DNSSDSERVICEREGISTRY_H
+#define DNSSDSERVICEREGISTRY_H
+
+#include <qdict.h>
+#include <qmap.h>
+#include "remoteservice.h"
+
+namespace DNSSD
+{
+
+/**
+Process-wide registry of RemoteService objects and their resolve results.
+
+Services created by RemoteService::shared() are registered by name, type, domain, network
+interface and protocol, so all browsers seeing one instance in the same place share one
+object and one resolver. Registry does not own
+them, service unregisters itself when it is deleted.
+
+Successful resolves of all services are also kept for ttl() milliseconds, so resolving
+new object for the same instance does not have to ask daemon again. They are kept by
+name, type and domain only, so they are found also by objects created for any interface.
+
+@short Internal registry of shared services and resolve cache
+ */
+class ServiceRegistry
+{
+public:
+	static ServiceRegistry& self();
+	~ServiceRegistry();
+
+	RemoteService* find(const QString& name, const QString& type, const QString& domain,
+		int interfaceIndex, RemoteService::Protocol protocol) const;
+	void insert(RemoteService* service);
+	void remove(RemoteService* service);
+
+	/**
+	Returns fresh resolve result of service if it is known
+	 */
+	bool lookup(const RemoteService* service, QString& host, unsigned short& port,
+		QMap<QString,QString>& text) const;
+	void store(const RemoteService* service);
+	void drop(const RemoteService* service);
+
+	void setTTL(int ttl);
+	int ttl() const { return m_ttl; }
+
+private:
+	ServiceRegistry();
+	static QString key(const QString& name, const QString& type, const QString& domain,
+		int interfaceIndex, RemoteService::Protocol protocol);
+	static QString key(const RemoteService* service);
+	// key of resolve result, without interface and protocol
+	static QString resolveKey(const RemoteService* service);
+	void expire();
+
+	struct Resolved
+	{
+		QString m_host;
+		unsigned short m_port;
+		QMap<QString,QString> m_text;
+		uint m_time;
+	};
+
+	QDict<RemoteService> m_services;
+	QMap<QString,Resolved> m_resolved;
+	int m_ttl;
+	static ServiceRegistry* m_self;
+};
+
+}
+
+#endif
@@ -0,0 +1,413 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <qapplication.h>
+#include <qguardedptr.h>
+#include <qdict.h>
+#include <qmap.h>
+#include <avahi-client/client.h>
+#ifdef AVAHI_API_0_6
+#include <avahi-client/lookup.h>
+#endif
+#include "sharedbrowser.h"
+#include "query.h"
+#include "sdevent.h"
+
+#ifdef AVAHI_API_0_6
+// limits and initial value of deadline for daemon to report AVAHI_BROWSER_ALL_FOR_NOW
+// in unicast domains, in milliseconds
+#define TIMEOUT_WAN_MIN 500
+#define TIMEOUT_WAN_MAX 15000
+#define TIMEOUT_WAN 2000
+#else
+#define TIMEOUT_LAN 200
+#endif
+
+namespace DNSSD
+{
+#ifdef AVAHI_API_0_6
+void services_callback(AvahiServiceBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent event, const char* name,
+    const char* regtype, const char* domain, AvahiLookupResultFlags, void* context);
+void types_callback(AvahiServiceTypeBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent event, const char* regtype,
+    const char* replyDomain, AvahiLookupResultFlags, void* context);
+#else
+void services_callback(AvahiServiceBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent event, const char* name,
+    const char* regtype, const char* domain, void* context);
+void types_callback(AvahiServiceTypeBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent event, const char* regtype,
+    const char* replyDomain, void* context);
+#endif
+
+// browsers by type, domain, interface and protocol. Browser which failed is removed, so 
+// next query gets new one
+static QDict<SharedBrowser> registry;
+
+SharedBrowser* SharedBrowser::acquire(const QString& type, const QString& domain,
+	AvahiIfIndex interface, AvahiProtocol protocol)
+{
+	QString key = type+'/'+domain+'/'+QString::number(interface)+'/'+QString::number(protocol);
+	SharedBrowser* b = registry.find(key);
+	if (!b) {
+		b = new SharedBrowser(type,domain,interface,protocol);
+		if (!b->m_responder->attach(b)) {
+			delete b;
+			return 0;
+		}
+		b->m_key = key;
+		registry.insert(key,b);
+		b->wait();
+	}
+	b->m_refs++;
+	return b;
+}
+
+SharedBrowser::SharedBrowser(const QString& type, const QString& domain, AvahiIfIndex interface,
+	AvahiProtocol protocol) : QObject(), ClientObject(BrowserObject), m_type(type), m_domain(domain),
+	m_interface(interface), m_protocol(protocol), m_browser(0), m_refs(0),
+	m_queue(this), m_known(127), m_created(false), m_resync(false), m_cacheExhausted(false),
+	m_concluded(false),
+	m_waiting(false), m_waitStart(0)
+{
+	m_browserType = (type=="_services._dns-sd._udp") ? Types : Services;
+	m_dnsType = type.ascii();
+#ifdef AVAHI_API_0_6
+	m_dnsDomain = domainToDNS(domain);
+#else
+	m_dnsDomain = domain.utf8();
+#endif
+	m_responder = &Responder::pick(BrowserObject);
+	connect(&m_timeout,SIGNAL(timeout()),this,SLOT(timeout()));
+}
+
+SharedBrowser::~SharedBrowser()
+{
+}
+
+void SharedBrowser::release()
+{
+	if (--m_refs) return;
+	if (registry.find(m_key)==this) registry.remove(m_key);
+	m_responder->detach(this);
+	// it may be delivering events right now
+	deleteLater();
+}
+
+void SharedBrowser::subscribe(Query* query)
+{
+	m_subscribers.append(query);
+	QGuardedPtr<Query> guard(query);
+	for (Instance* inst = m_known.first(); inst && guard; inst = m_known.next(inst)) {
+		ServiceEvent ev(ServiceEvent::Add, inst->m_interface, inst->m_protocol, inst->m_name,
+			inst->m_type, inst->m_domain, inst->m_cached);
+		QApplication::sendEvent(query, &ev);
+	}
+	if (guard && m_cacheExhausted) {
+		ServiceEvent ev(ServiceEvent::CacheExhausted, m_interface, m_protocol);
+		QApplication::sendEvent(query, &ev);
+	}
+	if (guard && m_concluded && !m_waiting) {
+		ServiceEvent ev(ServiceEvent::Finished, m_interface, m_protocol);
+		QApplication::sendEvent(query, &ev);
+	}
+}
+
+void SharedBrowser::unsubscribe(Query* query)
+{
+	m_subscribers.removeRef(query);
+}
+
+void SharedBrowser::deliver(ServiceEvent& event)
+{
+	// iterator survives removal of subscribers
+	QPtrListIterator<Query> it(m_subscribers);
+	for ( ; it.current(); ++it) QApplication::sendEvent(it.current(), &event);
+}
+
+bool SharedBrowser::create(AvahiClient* client)
+{
+	if (m_created) m_queue.add(AddRemoveEvent::Reset, 0, 0, 0);
+	m_created = true;
+	if (m_browserType==Types) 
+#ifdef AVAHI_API_0_6
+	    m_browser = avahi_service_type_browser_new(client, m_interface, m_protocol,
+		m_dnsDomain, (AvahiLookupFlags)0, types_callback, &m_queue);
+#else
+	    m_browser = avahi_service_type_browser_new(client, m_interface, m_protocol,
+		m_dnsDomain, types_callback, &m_queue);
+#endif
+	else
+#ifdef AVAHI_API_0_6
+	    m_browser = avahi_service_browser_new(client, m_interface, m_protocol,
+		m_dnsType, m_dnsDomain, (AvahiLookupFlags)0, services_callback, &m_queue);
+#else
+	    m_browser = avahi_service_browser_new(client, m_interface, m_protocol,
+		m_dnsType, m_dnsDomain, services_callback, &m_queue);
+#endif
+	if (m_browser) countObject(Statistics::Browsers,1);
+	return m_browser!=0;
+}
+
+void SharedBrowser::createFailed()
+{
+	// reported to queries the same way as failure of running browser
+	m_queue.add(AddRemoveEvent::Failure, 0, 0, 0, m_interface, m_protocol);
+}
+
+void SharedBrowser::destroy()
+{
+	if (m_browser) {
+	    switch (m_browserType) {
+		case Services: avahi_service_browser_free((AvahiServiceBrowser*)m_browser); break;
+		case Types: avahi_service_type_browser_free((AvahiServiceTypeBrowser*)m_browser); break;
+	    }
+	    countObject(Statistics::Browsers,-1);
+	}		    
+	m_browser = 0;
+}
+
+#ifdef AVAHI_API_0_6
+// expected time to AVAHI_BROWSER_ALL_FOR_NOW in unicast domains
+static QMap<QString,uint> expectedLatency;
+
+int SharedBrowser::deadline() const
+{
+	QMap<QString,uint>::ConstIterator it = expectedLatency.find(m_domain);
+	uint expected = (it==expectedLatency.end()) ? TIMEOUT_WAN/2 : it.data();
+	return QMIN(QMAX(2*expected,(uint)TIMEOUT_WAN_MIN),(uint)TIMEOUT_WAN_MAX);
+}
+
+void SharedBrowser::learn(uint elapsed)
+{
+	QMap<QString,uint>::Iterator it = expectedLatency.find(m_domain);
+	if (it==expectedLatency.end()) expectedLatency.insert(m_domain, elapsed);
+		else it.data() = (3*it.data()+elapsed)/4;
+}
+#endif
+
+void SharedBrowser::wait()
+{
+	m_waiting = true;
+	m_waitStart = timestamp();
+#ifdef AVAHI_API_0_6
+	// daemon always concludes multicast browsing, unicast one may take forever
+	if (!domainIsLocal(m_domain)) m_timeout.start(deadline(),true);
+#else
+	m_timeout.start(TIMEOUT_LAN,true);
+#endif
+}
+
+// key of instance in m_known: interface, protocol, type, domain and name separated by '/'.
+// Returns its length
+static uint instanceKey(char* key, uint size, const AddRemoveQueue::Entry& e)
+{
+	int len = snprintf(key, size, "%d/%d/%s/%s/%s", e.m_interface, e.m_protocol, e.m_type,
+		e.m_domain, e.m_name);
+	return QMIN((uint)len, size-1);
+}
+
+bool SharedBrowser::known(const AddRemoveQueue::Entry& e)
+{
+	char key[sizeof(e.m_name)+sizeof(e.m_type)+sizeof(e.m_domain)+32];
+	uint len = instanceKey(key, sizeof(key), e);
+	uint hash = hashKey(key);
+	Instance* inst = m_known.find(hash, (const char*)key);
+	if (e.m_op==AddRemoveEvent::Remove) {
+		if (inst && --inst->m_count<=0) m_known.remove(inst);
+		return true;
+	}
+	if (!inst) {
+		// records and their key buffers are reused, so steady churn does not allocate
+		inst = m_known.alloc();
+		if (inst->m_key.size()<len+1) inst->m_key.resize(len+1);
+		memcpy(inst->m_key.data(), key, len+1);
+		inst->m_count = 1;
+		inst->m_interface = e.m_interface;
+		inst->m_protocol = e.m_protocol;
+		inst->m_cached = e.m_cached;
+		// m_type has useless trailing dot
+		inst->m_name = internName(e.m_name);
+		inst->m_type = internType(e.m_type);
+		inst->m_domain = internDomain(e.m_domain);
+		m_known.insert(inst, hash);
+		return true;
+	}
+	// seen again after reconnection, it was already reported
+	return (inst->m_count++);
+}
+
+void SharedBrowser::customEvent(QCustomEvent* event)
+{
+	if (event->type()!=QEvent::User+SD_ADDREMOVE) return;
+	uint count = m_queue.take(m_batch);
+	if (!count) return;
+#ifndef AVAHI_API_0_6
+	// no end-of-batch events from daemon, wait for quiet period
+	wait();
+#endif
+	bool concluded = false;
+	for (uint i=0; i<count; i++) {
+		const AddRemoveQueue::Entry& e = m_batch[i];
+		switch (e.m_op) {
+		case AddRemoveEvent::Reset: {
+			for (Instance* inst = m_known.first(); inst; inst = m_known.next(inst))
+				inst->m_count = 0;
+			m_resync = true;
+			wait();
+			continue;
+		}
+#ifdef AVAHI_API_0_6
+		case AddRemoveEvent::CacheExhausted:
+			exhaustCache();
+			continue;
+		case AddRemoveEvent::AllForNow:
+			if (m_waiting && !domainIsLocal(m_domain)) learn(timestamp()-m_waitStart);
+			m_waiting = false;
+			concluded = true;
+			continue;
+#endif
+		case AddRemoveEvent::Failure: {
+			// this browser is dead, do not give it to new queries
+			if (registry.find(m_key)==this) registry.remove(m_key);
+			m_waiting = false;
+			concluded = true;
+			ServiceEvent ev(ServiceEvent::Failed, m_interface, m_protocol);
+			deliver(ev);
+			continue;
+		}
+		default:
+			break;
+		}
+		if (!known(e)) continue;
+		// event only borrows strings
+		QString name = internName(e.m_name);
+		QString type = internType(e.m_type);
+		QString domain = internDomain(e.m_domain);
+		ServiceEvent ev((e.m_op==AddRemoveEvent::Add) ? ServiceEvent::Add : ServiceEvent::Remove,
+			e.m_interface, e.m_protocol, name, type, domain, e.m_cached);
+		deliver(ev);
+	}
+#ifdef AVAHI_API_0_6
+	// after daemon concluded first batch, every following one is complete by itself
+	if (concluded || (m_concluded && !m_waiting)) finish();
+#endif
+}
+
+void SharedBrowser::timeout()
+{
+#ifdef AVAHI_API_0_6
+	// deadline passed before daemon concluded browsing
+	if (m_waiting) learn(deadline());
+#endif
+	finish();
+}
+
+void SharedBrowser::finish()
+{
+	m_waiting = false;
+	m_timeout.stop();
+	if (m_resync) {
+		m_resync = false;
+		Instance* next;
+		for (Instance* inst = m_known.first(); inst; inst = next) {
+			next = m_known.next(inst);
+			if (inst->m_count) continue;
+			// not seen after reconnection, so it is gone
+			ServiceEvent ev(ServiceEvent::Remove, inst->m_interface, inst->m_protocol, inst->m_name,
+				inst->m_type, inst->m_domain);
+			deliver(ev);
+			m_known.remove(inst);
+		}
+	}
+	// daemon may not report exhausted cache (or it is too old to do so)
+	exhaustCache();
+	m_concluded = true;
+	ServiceEvent ev(ServiceEvent::Finished, m_interface, m_protocol);
+	deliver(ev);
+}
+
+void SharedBrowser::exhaustCache()
+{
+	if (m_cacheExhausted) return;
+	m_cacheExhausted = true;
+	ServiceEvent ev(ServiceEvent::CacheExhausted, m_interface, m_protocol);
+	deliver(ev);
+}
+
+// returns false for events that are not passed to queries
+static bool browserOperation(AvahiBrowserEvent event, AddRemoveEvent::Operation& op)
+{
+	switch (event) {
+	case AVAHI_BROWSER_NEW: op = AddRemoveEvent::Add; return true;
+	case AVAHI_BROWSER_REMOVE: op = AddRemoveEvent::Remove; return true;
+#ifdef AVAHI_API_0_6
+	case AVAHI_BROWSER_CACHE_EXHAUSTED: op = AddRemoveEvent::CacheExhausted; return true;
+	case AVAHI_BROWSER_ALL_FOR_NOW: op = AddRemoveEvent::AllForNow; return true;
+	case AVAHI_BROWSER_FAILURE: op = AddRemoveEvent::Failure; return true;
+#endif
+	default: return false;
+	}
+}
+
+#ifdef AVAHI_API_0_6
+void services_callback (AvahiServiceBrowser*, AvahiIfIndex interface, AvahiProtocol protocol,
+    AvahiBrowserEvent event, const char* serviceName, const char* regtype, const char* replyDomain,
+    AvahiLookupResultFlags flags, void* context)
+#else
+void services_callback (AvahiServiceBrowser*, AvahiIfIndex interface, AvahiProtocol protocol,
+    AvahiBrowserEvent event, const char* serviceName, const char* regtype, const char* replyDomain,
+    void* context)
+#endif
+{
+	countCallback();
+	AddRemoveQueue *queue = reinterpret_cast<AddRemoveQueue*>(context);
+	AddRemoveEvent::Operation op;
+#ifdef AVAHI_API_0_6
+	bool cached = flags & AVAHI_LOOKUP_RESULT_CACHED;
+#else
+	bool cached = false;
+#endif
+	if (browserOperation(event,op))
+		queue->add(op, serviceName, regtype, replyDomain, interface, protocol, cached);
+}
+
+#ifdef AVAHI_API_0_6
+void types_callback(AvahiServiceTypeBrowser*, AvahiIfIndex interface, AvahiProtocol protocol,
+    AvahiBrowserEvent event, const char* regtype, const char* replyDomain, AvahiLookupResultFlags flags,
+    void* context)
+#else
+void types_callback(AvahiServiceTypeBrowser*, AvahiIfIndex interface, AvahiProtocol protocol,
+    AvahiBrowserEvent event, const char* regtype, const char* replyDomain, void* context)
+#endif
+{
+	countCallback();
+	AddRemoveQueue *queue = reinterpret_cast<AddRemoveQueue*>(context);
+	AddRemoveEvent::Operation op;
+#ifdef AVAHI_API_0_6
+	bool cached = flags & AVAHI_LOOKUP_RESULT_CACHED;
+#else
+	bool cached = false;
+#endif
+	if (browserOperation(event,op)) queue->add(op, 0, regtype, replyDomain, interface, protocol, cached);
+}
+
+}
+
+#include "sharedbrowser.moc"
@@ -0,0 +1,147 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DNSSDSHAREDBROWSER_H
+#define DNSSDSHAREDBROWSER_H
+
+#include <qobject.h>
+#include <qtimer.h>
+#include <qptrlist.h>
+#include <qvaluevector.h>
+#include "responder.h"
+#include "eventqueue.h"
+#include "recordtable.h"
+
+namespace DNSSD
+{
+class Query;
+
+/**
+Avahi browser for one service type in one domain on given interface and protocol (which
+may be AVAHI_IF_UNSPEC and AVAHI_PROTO_UNSPEC), shared by all queries for them.
+Queries are subscribed to it and get ServiceEvents. New subscriber is first sent
+everything that is currently known, so it does not have to wait for daemon.
+
+Instances answered from daemon's cache are marked as cached. When all of them were
+reported, CacheExhausted is delivered once, before first Finished at latest.
+
+Browsers are kept in process-wide registry and are reference counted.
+
+@short Internal avahi browser shared by queries
+ */
+class SharedBrowser : public QObject, public ClientObject
+{
+	Q_OBJECT
+public:
+	/**
+	Returns browser for given type, domain, interface and protocol, creating it if needed.
+	Returns 0 if browser cannot be attached to client.
+	 */
+	static SharedBrowser* acquire(const QString& type, const QString& domain,
+		AvahiIfIndex interface, AvahiProtocol protocol);
+	/**
+	Drops one reference. Browser is deleted when last one is gone.
+	 */
+	void release();
+
+	/**
+	Sends current instances to query and keeps it informed about changes
+	 */
+	void subscribe(Query* query);
+	void unsubscribe(Query* query);
+
+	/**
+	Queue avahi callbacks append to. Benchmarks feed it directly
+	 */
+	AddRemoveQueue* queue() { return &m_queue; }
+
+	virtual bool create(AvahiClient* client);
+	virtual void destroy();
+	virtual void createFailed();
+protected:
+	virtual void customEvent(QCustomEvent* event);
+private slots:
+	void timeout();
+private:
+	SharedBrowser(const QString& type, const QString& domain, AvahiIfIndex interface,
+		AvahiProtocol protocol);
+	~SharedBrowser();
+
+	struct Instance
+	{
+		Instance* m_next;
+		uint m_hash;
+		// see instanceKey(), buffer stays with record when it is reused
+		QMemArray<char> m_key;
+		bool matches(const char* key) const { return !qstrcmp(m_key.data(), key); }
+		// number of additions not matched by removals, 0 means that instance was
+		// reported before reconnection and has not been seen since
+		int m_count;
+		int m_interface;
+		int m_protocol;
+		bool m_cached;
+		QString m_name;
+		QString m_type;
+		QString m_domain;
+	};
+	enum BrowserType { Types, Services };
+
+	// returns true if change should be reported
+	bool known(const AddRemoveQueue::Entry& e);
+	void wait();
+	void finish();
+	void exhaustCache();
+	void deliver(ServiceEvent& event);
+#ifdef AVAHI_API_0_6
+	// deadline for current domain, it is doubled expected time of ALL_FOR_NOW
+	int deadline() const;
+	void learn(uint elapsed);
+#endif
+
+	QString m_key;
+	QString m_type;
+	QString m_domain;
+	AvahiIfIndex m_interface;
+	AvahiProtocol m_protocol;
+	// type and domain prepared for avahi
+	QCString m_dnsType;
+	QCString m_dnsDomain;
+	BrowserType m_browserType;
+	void* m_browser;
+	Responder* m_responder;
+	uint m_refs;
+	QPtrList<Query> m_subscribers;
+	AddRemoveQueue m_queue;
+	QValueVector<AddRemoveQueue::Entry> m_batch;
+	RecordTable<Instance> m_known;
+	// browser was created before, so next one is result of reconnection
+	bool m_created;
+	bool m_resync;
+	// daemon has reported everything from its cache
+	bool m_cacheExhausted;
+	// daemon has concluded browsing at least once
+	bool m_concluded;
+	// waiting for daemon to report all services, since m_waitStart
+	bool m_waiting;
+	uint m_waitStart;
+	QTimer m_timeout;
+};
+
+}
+
+#endif
@@ -0,0 +1,159 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <time.h>
+#include "statistics.h"
+#include "responder.h"
+
+// counters below are updated from avahi thread too
+#define ATOMIC_ADD(ptr,value) __sync_fetch_and_add(ptr,value)
+
+namespace DNSSD
+{
+
+struct Counters
+{
+	volatile int m_live[Statistics::Objects];
+	volatile unsigned long m_callbacks;
+	volatile unsigned long m_events;
+	volatile unsigned long m_flaps;
+	volatile unsigned long m_histogram[Statistics::Latencies][Statistics::Buckets];
+	// state of callbackRate() and eventRate()
+	unsigned long m_lastCallbacks;
+	uint m_lastCallbackTime;
+	unsigned long m_lastEvents;
+	uint m_lastEventTime;
+};
+
+static Counters counters;
+
+static double rate(unsigned long count, unsigned long& lastCount, uint& lastTime)
+{
+	uint now = timestamp();
+	uint elapsed = now-lastTime;
+	double r = (elapsed) ? (count-lastCount)*1000.0/elapsed : 0.0;
+	lastCount = count;
+	lastTime = now;
+	return r;
+}
+
+int Statistics::liveCount(Object object)
+{
+	return counters.m_live[object];
+}
+
+unsigned long Statistics::callbacks()
+{
+	return counters.m_callbacks;
+}
+
+unsigned long Statistics::events()
+{
+	return counters.m_events;
+}
+
+double Statistics::callbackRate()
+{
+	return rate(counters.m_callbacks, counters.m_lastCallbacks, counters.m_lastCallbackTime);
+}
+
+double Statistics::eventRate()
+{
+	return rate(counters.m_events, counters.m_lastEvents, counters.m_lastEventTime);
+}
+
+unsigned long Statistics::flaps()
+{
+	return counters.m_flaps;
+}
+
+unsigned long Statistics::histogram(Latency latency, int bucket)
+{
+	if (bucket<0 || bucket>=Buckets) return 0;
+	return counters.m_histogram[latency][bucket];
+}
+
+unsigned long Statistics::samples(Latency latency)
+{
+	unsigned long sum = 0;
+	for (int i=0; i<Buckets; i++) sum+=counters.m_histogram[latency][i];
+	return sum;
+}
+
+int Statistics::percentile(Latency latency, int percent)
+{
+	unsigned long total = samples(latency);
+	if (!total) return -1;
+	unsigned long wanted = (total*percent+99)/100;
+	unsigned long sum = 0;
+	for (int i=0; i<Buckets; i++) {
+		sum+=counters.m_histogram[latency][i];
+		if (sum>=wanted) return 1<<i;
+	}
+	return 1<<(Buckets-1);
+}
+
+void Statistics::reset()
+{
+	counters.m_callbacks = counters.m_lastCallbacks = 0;
+	counters.m_events = counters.m_lastEvents = 0;
+	counters.m_flaps = 0;
+	counters.m_lastCallbackTime = counters.m_lastEventTime = timestamp();
+	for (int i=0; i<Latencies; i++)
+		for (int j=0; j<Buckets; j++) counters.m_histogram[i][j] = 0;
+}
+
+void countObject(Statistics::Object object, int delta)
+{
+	ATOMIC_ADD(&counters.m_live[object], delta);
+}
+
+void countCallback()
+{
+	ATOMIC_ADD(&counters.m_callbacks, 1ul);
+}
+
+void countEvent()
+{
+	ATOMIC_ADD(&counters.m_events, 1ul);
+}
+
+void countFlap()
+{
+	ATOMIC_ADD(&counters.m_flaps, 1ul);
+}
+
+uint timestamp()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return now.tv_sec*1000+now.tv_nsec/1000000;
+}
+
+void recordLatency(Statistics::Latency latency, uint start)
+{
+	uint elapsed = timestamp()-start;
+	int bucket = 0;
+	while (elapsed && bucket<Statistics::Buckets-1) {
+		elapsed >>= 1;
+		bucket++;
+	}
+	ATOMIC_ADD(&counters.m_histogram[latency][bucket], 1ul);
+}
+
+}
@@ -0,0 +1,119 @@
+/* This file is part of the KDE project
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DNSSDSTATISTICS_H
+#define DNSSDSTATISTICS_H
+
+#include <kdelibs_export.h>
+
+namespace DNSSD
+{
+
+/**
+This class reports what the library is doing: how many avahi objects exist, how busy
+avahi callbacks are and how long typical operations take. Counters are always kept,
+updating them costs only few instructions.
+
+Latencies are collected into histograms with logarithmic buckets: bucket 0 holds samples
+shorter than 1 ms and bucket i holds samples from 2^(i-1) to 2^i ms. Last bucket also holds
+everything longer.
+
+@short Library usage statistics
+ */
+class KDNSSD_EXPORT Statistics
+{
+public:
+	/**
+	Kinds of avahi objects
+	@li Browsers - service, service type and domain browsers
+	@li Resolvers - service resolvers
+	@li EntryGroups - entry groups used for publishing
+	 */
+	enum Object { Browsers, Resolvers, EntryGroups, Objects };
+
+	/**
+	Measured operations
+	@li FirstResult - from start of Query to first service found
+	@li QueryFinished - from start of Query to finished() signal
+	@li Resolve - from RemoteService::resolveAsync() to resolved() signal
+	@li Publish - from PublicService::publishAsync() to service being established
+	@li ResolveWait - time service waited in ResolveScheduler queue before resolving started
+	 */
+	enum Latency { FirstResult, QueryFinished, Resolve, Publish, ResolveWait, Latencies };
+
+	enum { Buckets = 16 };
+
+	/**
+	Returns number of currently existing avahi objects of given kind
+	 */
+	static int liveCount(Object object);
+
+	/**
+	Returns number of avahi callbacks invoked since last reset()
+	 */
+	static unsigned long callbacks();
+
+	/**
+	Returns number of events sent or posted to DNSSD objects since last reset(). Compared
+	to callbacks() it shows how well callbacks are batched.
+	 */
+	static unsigned long events();
+
+	/**
+	Returns number of avahi callbacks per second since previous call of this
+	function or reset()
+	 */
+	static double callbackRate();
+
+	/**
+	Returns number of events per second since previous call of this function or reset()
+	 */
+	static double eventRate();
+
+	/**
+	Returns number of service removals suppressed since last reset() because service
+	appeared again within ServiceBrowser damping interval.
+	@see ServiceBrowser::setDampingInterval()
+	 */
+	static unsigned long flaps();
+
+	/**
+	Returns number of samples of given operation in given bucket
+	 */
+	static unsigned long histogram(Latency latency, int bucket);
+
+	/**
+	Returns number of samples of given operation
+	 */
+	static unsigned long samples(Latency latency);
+
+	/**
+	Returns upper bound (in ms) of the bucket containing given percentile of samples,
+	-1 if there are none.
+	 */
+	static int percentile(Latency latency, int percent);
+
+	/**
+	Clears callback and event counters and all histograms. Live counts are kept.
+	 */
+	static void reset();
+};
+
+}
+
+#endif